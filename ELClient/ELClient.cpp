@@ -94,8 +94,8 @@ ELClientPacket* ELClient::protoCompletedCb(void) {
 
 /*! Process()
 @brief Handle serial input.
-@details Read all characters available on the serial input and process any messages that arrive,
-	but stop if a non-callback response comes in
+@details Run any attached services, then read all characters available on the serial input and
+	process any messages that arrive, but stop if a non-callback response comes in
 @return <code>ELClientPacket</code>
 	Pointer to ELClientResponse structure with the received response
 @par Example
@@ -114,6 +114,7 @@ ELClientPacket* ELClient::protoCompletedCb(void) {
 */
 ELClientPacket *ELClient::Process() {
   int value;
+  runServices();
   while (_serial->available()) {
     value = _serial->read();
     if (value == SLIP_ESC) {
@@ -304,6 +305,101 @@ void ELClient::Request(const __FlashStringHelper* data, uint16_t len) {
   }
 }
 
+/*! Request(ELClientProducer producer, void* ctx, uint16_t len)
+@brief Append an argument generated by a producer to the request
+@details The producer prints the data of the argument piecewise, which is sent as it is produced
+	so it never needs to be staged in RAM. If the producer generates more than len bytes the excess
+	is dropped, if it generates less the argument is filled up with null bytes.
+@note
+	This function is usually not needed for applications. The communication to the ESP8266 is handled by the cmd, rest, mqtt, tcp and udp library parts.
+@param producer
+	Function that generates the data, see ELClientProducer
+@param ctx
+	Context pointer passed to the producer
+@param len
+	(optional) Length of the argument, if 0 the producer is run an additional time to measure it
+@return <code>uint16_t</code>
+	Length of the argument
+@par Example
+@code
+	boolean temperatureJson(Print* out, uint16_t chunk, void* ctx) {
+		out->print(F("{\"temp\":"));
+		out->print(*(float*)ctx, 1);
+		out->print('}');
+		return false;
+	}
+
+	_elc->Request(CMD_MQTT_PUBLISH, 0, 5);
+	_elc->Request(topic, strlen(topic));
+	uint16_t len = _elc->Request(temperatureJson, &temperature);
+	_elc->Request(&len, 2);
+	...
+@endcode
+*/
+uint16_t ELClient::Request(ELClientProducer producer, void* ctx, uint16_t len) {
+  if (len == 0) len = Measure(producer, ctx);
+
+  // write the length
+  write(&len, 2);
+  crc = crc16Data((unsigned const char*)&len, 2, crc);
+
+  // output the data as it is produced
+  ELClientArg out(this, len);
+  for (uint16_t chunk=0; producer(&out, chunk, ctx); chunk++)
+    ;
+  while (out.count < len)
+    out.write((uint8_t)0);
+
+  // output padding
+  uint16_t pad = (4-(len&3))&3;
+  uint8_t temp = 0;
+  while (pad--) {
+    write(temp);
+    crc = crc16Add(temp, crc);
+  }
+  return len;
+}
+
+/*! PrintBlock(Print* out, uint16_t chunk, void* ctx)
+@brief Producer that prints a block of data in RAM or program memory
+@param out
+	Print to output to
+@param chunk
+	Chunk number, unused
+@param ctx
+	Pointer to an ELClientBlock
+@return <code>boolean</code>
+	False, the whole block is printed in one go
+*/
+boolean ELClient::PrintBlock(Print* out, uint16_t, void* ctx) {
+  ELClientBlock* b = (ELClientBlock*)ctx;
+  if (!b->flash) {
+    out->write((const uint8_t*)b->data, b->len);
+    return false;
+  }
+  PGM_P p = reinterpret_cast<PGM_P>(b->data);
+  for (uint16_t l=b->len; l>0; l--)
+    out->write(pgm_read_byte(p++));
+  return false;
+}
+
+/*! Measure(ELClientProducer producer, void* ctx)
+@brief Measure the length of the data generated by a producer
+@details Runs the producer without sending anything and counts the bytes it generates
+@param producer
+	Function that generates the data, see ELClientProducer
+@param ctx
+	Context pointer passed to the producer
+@return <code>uint16_t</code>
+	Number of bytes generated
+*/
+uint16_t ELClient::Measure(ELClientProducer producer, void* ctx) {
+  ELClientArg out(NULL);
+  for (uint16_t chunk=0; producer(&out, chunk, ctx); chunk++)
+    ;
+  return out.count;
+}
+
 /*! Request(void)
 @brief Finish the request
 @details Send final CRC and SLIP_END to the ESP to finish the request
@@ -324,6 +420,37 @@ void ELClient::Request(void) {
   _serial->write(SLIP_END);
 }
 
+//===== Producer output
+
+/*! ELClientArg(ELClient* elc, uint16_t limit)
+@brief Create the output for a producer
+@param elc
+	ELClient to stream the bytes to, NULL to only count them
+@param limit
+	(optional) Maximum number of bytes to accept
+*/
+ELClientArg::ELClientArg(ELClient* elc, uint16_t limit) :
+count(0), _elc(elc), _limit(limit) {
+}
+
+/*! write(uint8_t c)
+@brief Output a byte produced for an argument
+@details Sends the byte with SLIP escaping and adds it to the CRC, or just counts it when measuring
+@param c
+	Byte to output
+@return <code>size_t</code>
+	1 if the byte was accepted, 0 if the limit has been reached
+*/
+size_t ELClientArg::write(uint8_t c) {
+  if (count >= _limit) return 0;
+  count++;
+  if (_elc != NULL) {
+    _elc->write(c);
+    _elc->crc = _elc->crc16Add(c, _elc->crc);
+  }
+  return 1;
+}
+
 //===== Initialization
 
 /*! init()
@@ -341,6 +468,11 @@ void ELClient::init() {
   _proto.bufSize = sizeof(_protoBuf);
   _proto.dataLen = 0;
   _proto.isEsc = 0;
+  _services = NULL;
+  _serviceAt = 0;
+  _inService = false;
+  _swapOwner = NULL;
+  _syncCount = 0;
 }
 
 /*! ELClient(Stream* serial)
@@ -450,6 +582,84 @@ ELClientPacket *ELClient::WaitReturn(uint32_t timeout) {
   return NULL;
 }
 
+//===== Services
+
+/*! swapBuffer(uint8_t* buf)
+@brief Exchange the protocol buffer during a callback
+@details Hands the buffer that holds the packet being dispatched to the caller and continues receiving
+	into buf. The caller owns the returned buffer and must hand it back through a later swapBuffer
+	once it is done with the packet, so buffers circulate between ELClient and the caller. Passing NULL
+	ends the circulation: ELClient receives into its internal buffer again and the buffer it was using
+	goes back to the caller, the caller has to give up the internal buffer if it holds it. Only one
+	caller may circulate buffers at a time, as it couldn't tell its buffers from those of another
+	one. It registers itself in _swapOwner.
+@note
+	This function is usually not needed for applications, ELClientSocket uses it for its receive pool.
+@param buf
+	Buffer of ESP_BUFSIZE bytes to receive the next packets into, NULL for the internal buffer
+@return <code>uint8_t*</code>
+	Buffer holding the packet being dispatched
+*/
+uint8_t* ELClient::swapBuffer(uint8_t* buf) {
+  uint8_t* old = _proto.buf;
+  _proto.buf = buf != NULL ? buf : _protoBuf;
+  return old;
+}
+
+/*! attachService(ELClientService* svc)
+@brief Attach a service to be run from Process()
+@details Services do periodic work such as timeouts or rate-limited sending on behalf of the
+	library parts, they are run from Process() at most once per millisecond.
+@note
+	This function is usually not needed for applications, the library parts attach their services themselves.
+@param svc
+	Service to attach, attaching a service that is already attached has no effect
+*/
+void ELClient::attachService(ELClientService* svc) {
+  for (ELClientService* s = _services; s != NULL; s = s->_nextService)
+    if (s == svc) return;
+  svc->_nextService = _services;
+  _services = svc;
+}
+
+/*! detachService(ELClientService* svc)
+@brief Detach a service
+@param svc
+	Service to detach
+*/
+void ELClient::detachService(ELClientService* svc) {
+  ELClientService** link = &_services;
+  while (*link != NULL) {
+    if (*link == svc) {
+      *link = svc->_nextService;
+      svc->_nextService = NULL;
+      return;
+    }
+    link = &(*link)->_nextService;
+  }
+}
+
+/*! runServices(void)
+@brief Run all attached services
+@details Services are run at most once per millisecond and not recursively, i.e., not when a
+	service calls Process() itself, e.g. through a callback that waits for a response.
+@note Internal library function
+*/
+void ELClient::runServices(void) {
+  if (_services == NULL || _inService) return;
+  uint32_t now = millis();
+  if (now == _serviceAt) return;
+  _serviceAt = now;
+  _inService = true;
+  ELClientService* s = _services;
+  while (s != NULL) {
+    ELClientService* next = s->_nextService; // a service may detach itself
+    s->service(now);
+    s = next;
+  }
+  _inService = false;
+}
+
 //===== CRC helper functions
 
 /*! crc16Add(unsigned char b, uint16_t acc)
@@ -534,6 +744,7 @@ boolean ELClient::Sync(uint32_t timeout) {
     if (packet->value == (uint32_t)&wifiCb) {
         if (_debugEn) _debug->println("SYNC!");
         resetCb = rr;
+        _syncCount++;
         return true;
     }
     if (_debugEn) {
@@ -12,6 +12,7 @@
 #include "FP.h"
 
 #define ESP_TIMEOUT 2000 /**< Default timeout for TCP requests when waiting for a response */
+#define ESP_BUFSIZE 128  /**< Size of the protocol buffer, the largest packet that can be received */
 
 // Enumeration of commands supported by esp-link, this needs to match the definition in
 // esp-link!
@@ -30,6 +31,7 @@ typedef enum {
   CMD_MQTT_PUBLISH,    /**< Publish MQTT topic */
   CMD_MQTT_SUBSCRIBE,  /**< Subscribe to MQTT topic */
   CMD_MQTT_LWT,        /**< Define MQTT last will */
+  CMD_MQTT_PREFIX,     /**< Define MQTT topic prefix for relative topics */
 
   CMD_REST_SETUP = 20, /**< Setup REST connection */
   CMD_REST_REQUEST,    /**< Make request to REST server */
@@ -58,6 +60,47 @@ typedef struct {
   uint8_t isEsc;
 } ELClientProtocol; /**< Protocol structure  */
 
+class ELClient;
+
+// A producer generates the data of a request argument piecewise by printing to out. It is called
+// with chunk = 0, 1, 2, ... until it returns false. If the length of the data is not declared
+// up-front the producer is run twice, once to measure and once to send, so it must produce the
+// same output on both runs.
+typedef boolean (*ELClientProducer)(Print* out, uint16_t chunk, void* ctx);
+
+// A block of data in RAM or in program memory, ELClient::PrintBlock is a producer that prints it
+typedef struct {
+  const void* data; /**< Pointer to the data */
+  uint16_t len;     /**< Length of the data */
+  boolean flash;    /**< Data is stored in program memory */
+} ELClientBlock;
+
+// ELClientArg is the Print that producers write to. It either streams the bytes straight into
+// the request being sent, or only counts them when measuring. Output beyond the limit is dropped.
+class ELClientArg : public Print {
+  public:
+    ELClientArg(ELClient* elc, uint16_t limit=0xFFFF);
+    virtual size_t write(uint8_t c);
+    using Print::write;
+    uint16_t count; /**< Number of bytes written so far */
+
+  private:
+    ELClient* _elc; /**< ELClient to send to, NULL when measuring */
+    uint16_t _limit; /**< Maximum number of bytes accepted */
+};
+
+// ELClientService is the base class for library parts that need to do periodic work, such as
+// handling timeouts or rate-limited sending. Services attached to ELClient are run from Process()
+// at most once per millisecond, so they must be quick and must not block or wait for responses.
+class ELClientService {
+  public:
+    ELClientService() : _nextService(0) {}
+    // Do any pending work, now is the current millis()
+    virtual void service(uint32_t now) = 0;
+
+    ELClientService* _nextService; /**< Next attached service */
+};
+
 // The ELClient class implements the basic protocol to communicate with esp-link using SLIP.
 // The SLIP protocol just provides framing, i.e., it delineates the start and end of packets.
 // The format of each packet is dictated by ELClient and consists of a 2-byte command, a 2-byte
@@ -93,6 +136,11 @@ class ELClient {
     void Request(const void* data, uint16_t len);
     // Add a an argument consisting of a data block in flash to a request
     void Request(const __FlashStringHelper* data, uint16_t len);
+    // Add an argument whose data is generated by a producer, if len is 0 the producer is run
+    // once to measure the length first. Returns the length of the argument.
+    uint16_t Request(ELClientProducer producer, void* ctx, uint16_t len=0);
+    // Producer that prints an ELClientBlock
+    static boolean PrintBlock(Print* out, uint16_t chunk, void* ctx);
     // Finish a request
     void Request(void);
 
@@ -107,6 +155,18 @@ class ELClient {
     // create an ELClientResponse.
     ELClientPacket *WaitReturn(uint32_t timeout=ESP_TIMEOUT);
 
+    // Continue receiving into buf and return the buffer holding the packet that is being
+    // dispatched, so a callback can keep the packet without copying it. buf must hold
+    // ESP_BUFSIZE bytes. Only valid during a callback. NULL goes back to the internal buffer.
+    // Only one caller at a time may circulate buffers, ELClientSocket registers in _swapOwner.
+    uint8_t* swapBuffer(uint8_t* buf);
+
+    //== Services
+    // Attach a service to be run from Process(), attaching a service twice has no effect
+    void attachService(ELClientService* svc);
+    // Detach a previously attached service
+    void detachService(ELClientService* svc);
+
     //== Commands built-into ELClient
     // Initialize and synchronize communication with esp-link with a timeout in milliseconds,
     // and remove all existing callbacks. Registers the wifiCb and returns true on success
@@ -125,7 +185,12 @@ class ELClient {
     boolean _debugEn; /**< Flag for debug - True = enabled, False = disabled */
     uint16_t crc; /**< CRC checksum */
     ELClientProtocol _proto; /**< Protocol structure */
-    uint8_t _protoBuf[128]; /**< Protocol buffer */
+    uint8_t _protoBuf[ESP_BUFSIZE]; /**< Protocol buffer */
+    ELClientService* _services; /**< List of attached services */
+    uint32_t _serviceAt; /**< Time the services were last run */
+    boolean _inService; /**< Services are running, prevents recursion */
+    void* _swapOwner; /**< Receive pool whose buffers circulate through swapBuffer, NULL if none */
+    uint8_t _syncCount; /**< Number of successful Syncs, state registered with esp-link before the last one is lost */
 
     void init();
     void DBG(const char* info);
@@ -134,5 +199,7 @@ class ELClient {
     void write(void* data, uint16_t len);
     uint16_t crc16Add(unsigned char b, uint16_t acc);
     uint16_t crc16Data(const unsigned char *data, uint16_t len, uint16_t acc);
+    uint16_t Measure(ELClientProducer producer, void* ctx);
+    void runServices(void);
 };
 #endif // _EL_CLIENT_H_
@@ -0,0 +1,589 @@
+/*! \file ELClientJson.cpp
+    \brief Constructor and functions for ELClientJson
+*/
+#include "ELClientJson.h"
+#include "ELClientRest.h"
+#include "ELClientMqtt.h"
+
+/*! ELClientJson()
+@brief Constructor for ELClientJson
+@par Example
+@code
+  ELClientJson json;
+@endcode
+*/
+ELClientJson::ELClientJson() :_bindings(0), _bindCount(0) {
+  reset();
+}
+
+/*! setBindings(ELClientJsonBinding* bindings, uint8_t count)
+@brief Bind paths to variables
+@param bindings
+  Array of bindings, must remain valid
+@param count
+  Number of bindings
+@par Example
+@code
+  float temp;
+  int32_t humidity;
+  char weather[16];
+  ELClientJsonBinding bindings[] = {
+    { "main.temp", JSON_FLOAT, &temp },
+    { "main.humidity", JSON_INT, &humidity },
+    { "weather[0].main", JSON_STRING, weather, sizeof(weather) },
+  };
+
+  json.setBindings(bindings, 3);
+  rest.chunkCb.attach(&json, &ELClientJson::restChunk);
+@endcode
+*/
+void ELClientJson::setBindings(ELClientJsonBinding* bindings, uint8_t count) {
+  _bindings = bindings;
+  _bindCount = count;
+  reset();
+}
+
+/*! reset(void)
+@brief Start parsing a new document
+@details Clears the found flags of the bindings, the bound variables keep their values.
+*/
+void ELClientJson::reset(void) {
+  _state = JSON_S_VALUE;
+  _inKey = false;
+  _depth = 0;
+  _isArray = 0;
+  _tokLen = 0;
+  _strOut = NULL;
+  for (uint8_t i=0; i<_bindCount; i++) {
+    _bindings[i].found = false;
+    _bindings[i].keys = 0;
+  }
+}
+
+/*! feed(const uint8_t* data, uint16_t len)
+@brief Parse the next piece of the document
+@param data
+  Piece of the document
+@param len
+  Length of the piece
+@return <code>boolean</code>
+  False if the document has a syntax error
+*/
+boolean ELClientJson::feed(const uint8_t* data, uint16_t len) {
+  while (len-- > 0)
+    if (!put(*data++)) return false;
+  return true;
+}
+
+/*! finish(void)
+@brief Signal the end of the document
+@details Completes a number at the top level, which can't be recognized as complete before.
+@return <code>boolean</code>
+  True if a complete document has been parsed
+*/
+boolean ELClientJson::finish(void) {
+  if (_state == JSON_S_SCALAR) endScalar();
+  return done();
+}
+
+/*! match(const char* path)
+@brief Check whether the value being parsed is at a path
+@details The parser only keeps a 16-bit hash of each key on the way to the value, so a key in the
+  document with the same hash as the one in the path matches too. Bindings don't have this
+  problem, their keys are compared character by character as they arrive.
+@param path
+  Path, e.g. "main.temp" or "weather[0].id"
+@return <code>boolean</code>
+  True if the value is at the path
+@par Example
+@code
+  void jsonEvent(void* e) {
+    ELClientJsonEvent* ev = (ELClientJsonEvent*)e;
+    if (ev->event == JSON_EVENT_ARRAY && json.match("list")) Serial.println("list starts");
+  }
+@endcode
+*/
+boolean ELClientJson::match(const char* path) {
+  uint8_t level = 0;
+  while (*path != 0) {
+    if (level >= _depth) return false;
+    boolean array = (_isArray >> level) & 1;
+    if (*path == '[') {
+      uint16_t index = 0;
+      for (path++; *path >= '0' && *path <= '9'; path++)
+        index = index * 10 + (*path - '0');
+      if (*path == ']') path++;
+      if (!array || _pos[level] != index) return false;
+    } else {
+      if (*path == '.') path++;
+      uint16_t hash = 5381;
+      for (; *path != 0 && *path != '.' && *path != '['; path++)
+        hash = hashAdd(hash, *path);
+      if (array || _pos[level] != hash) return false;
+    }
+    level++;
+  }
+  return level == _depth;
+}
+
+/*! put(char c)
+@brief Parse the next character
+@note Internal library function
+@param c
+  Character
+@return <code>boolean</code>
+  False if the document has a syntax error
+*/
+boolean ELClientJson::put(char c) {
+  boolean space = c == ' ' || c == '\t' || c == '\r' || c == '\n';
+  switch (_state) {
+  case JSON_S_VALUE_OR_END:
+    if (space) break;
+    // the first element or the end of an empty array
+    _state = c == ']' ? JSON_S_NEXT : JSON_S_VALUE;
+    return put(c);
+
+  case JSON_S_VALUE:
+    if (space) break;
+    if (c == '{' || c == '[') {
+      if (_depth == JSON_MAX_DEPTH) {
+        _state = JSON_S_ERROR;
+        break;
+      }
+      emit(c == '{' ? JSON_EVENT_OBJECT : JSON_EVENT_ARRAY);
+      if (c == '[') _isArray |= 1 << _depth;
+      else          _isArray &= ~(1 << _depth);
+      _pos[_depth++] = 0;
+      _state = c == '{' ? JSON_S_KEY_OR_END : JSON_S_VALUE_OR_END;
+    } else if (c == '"') {
+      startValue();
+      // strings bound to a buffer are copied straight into it
+      for (uint8_t i=0; i<_bindCount && _strOut == NULL; i++)
+        if (_bindings[i].type == JSON_STRING && _bindings[i].size > 0 && matchBinding(&_bindings[i]))
+          _strOut = &_bindings[i];
+      _state = JSON_S_STRING;
+    } else if (c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' || c == 'n') {
+      startValue();
+      addChar(c);
+      if (c == '-' || (c >= '0' && c <= '9')) {
+        _num = JSON_N_START;
+        numberChar(c);
+      }
+      _state = JSON_S_SCALAR;
+    } else {
+      _state = JSON_S_ERROR;
+    }
+    break;
+
+  case JSON_S_KEY_OR_END:
+  case JSON_S_MEMBER:
+    if (space) break;
+    if (c == '"') {
+      _inKey = true;
+      _pos[_depth-1] = 5381;
+      for (uint8_t i=0; i<_bindCount; i++) {
+        _bindings[i].keys &= ~(1 << (_depth-1));
+        _bindings[i].keyPos = keyStart(_bindings[i].path, _depth-1);
+      }
+      _state = JSON_S_KEY;
+    } else if (c == '}' && _state == JSON_S_KEY_OR_END) {
+      // empty object, after a comma only another member may follow
+      _state = JSON_S_NEXT;
+      return put(c);
+    } else {
+      _state = JSON_S_ERROR;
+    }
+    break;
+
+  case JSON_S_KEY:
+  case JSON_S_STRING:
+    if (c == '\\') {
+      _state = JSON_S_ESCAPE;
+    } else if (c != '"') {
+      addChar(c);
+    } else if (_inKey) {
+      compareKey(0);
+      _state = JSON_S_COLON;
+    } else {
+      if (_strOut != NULL) {
+        ((char*)_strOut->out)[_strLen] = 0;
+        _strOut->found = true;
+      }
+      _tok[_tokLen] = 0;
+      emit(JSON_EVENT_STRING);
+      bind(JSON_EVENT_STRING);
+      endValue();
+    }
+    break;
+
+  case JSON_S_ESCAPE:
+    _state = _inKey ? JSON_S_KEY : JSON_S_STRING;
+    switch (c) {
+    case 'b': addChar('\b'); break;
+    case 'f': addChar('\f'); break;
+    case 'n': addChar('\n'); break;
+    case 'r': addChar('\r'); break;
+    case 't': addChar('\t'); break;
+    case 'u':
+      _unicode = 0;
+      _unicodeLen = 0;
+      _state = JSON_S_UNICODE;
+      break;
+    default: addChar(c); break;
+    }
+    break;
+
+  case JSON_S_UNICODE:
+    _unicode <<= 4;
+    if (c >= '0' && c <= '9')      _unicode |= c - '0';
+    else if (c >= 'a' && c <= 'f') _unicode |= c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') _unicode |= c - 'A' + 10;
+    else {
+      _state = JSON_S_ERROR;
+      break;
+    }
+    if (++_unicodeLen < 4) break;
+    // append as UTF-8
+    if (_unicode < 0x80) {
+      addChar(_unicode);
+    } else if (_unicode < 0x800) {
+      addChar(0xC0 | (_unicode >> 6));
+      addChar(0x80 | (_unicode & 0x3F));
+    } else {
+      addChar(0xE0 | (_unicode >> 12));
+      addChar(0x80 | ((_unicode >> 6) & 0x3F));
+      addChar(0x80 | (_unicode & 0x3F));
+    }
+    _state = _inKey ? JSON_S_KEY : JSON_S_STRING;
+    break;
+
+  case JSON_S_COLON:
+    if (space) break;
+    _state = c == ':' ? JSON_S_VALUE : JSON_S_ERROR;
+    break;
+
+  case JSON_S_SCALAR:
+    if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '.' || c == '-' || c == '+' ||
+        c == 'E') {
+      addChar(c);
+      if (_num != JSON_N_NONE) numberChar(c);
+      if (_num == JSON_N_BAD) _state = JSON_S_ERROR;
+      break;
+    }
+    endScalar();
+    if (_state == JSON_S_ERROR) break;
+    return put(c);
+
+  case JSON_S_NEXT:
+    if (space) break;
+    if (c == ',') {
+      if ((_isArray >> (_depth-1)) & 1) {
+        _pos[_depth-1]++;
+        _state = JSON_S_VALUE;
+      } else {
+        _state = JSON_S_MEMBER;
+      }
+    } else if (c == '}' || c == ']') {
+      boolean array = (_isArray >> (_depth-1)) & 1;
+      if (array != (c == ']')) {
+        _state = JSON_S_ERROR;
+        break;
+      }
+      _depth--;
+      emit(array ? JSON_EVENT_END_ARRAY : JSON_EVENT_END_OBJECT);
+      endValue();
+    } else {
+      _state = JSON_S_ERROR;
+    }
+    break;
+
+  case JSON_S_DONE:
+    if (!space) _state = JSON_S_ERROR;
+    break;
+  }
+  return _state != JSON_S_ERROR;
+}
+
+/*! addChar(char c)
+@brief Append a character to the current key, string or number
+@note Internal library function
+@param c
+  Character
+*/
+void ELClientJson::addChar(char c) {
+  if (_inKey) {
+    _pos[_depth-1] = hashAdd(_pos[_depth-1], c);
+    compareKey(c);
+    return;
+  }
+  if (_tokLen < JSON_TOKEN_MAX) _tok[_tokLen++] = c;
+  else                          _tokTrunc = true;
+  if (_strOut != NULL && _strLen < _strOut->size - 1)
+    ((char*)_strOut->out)[_strLen++] = c;
+}
+
+/*! startValue(void)
+@brief Start a string or scalar value
+@note Internal library function
+*/
+void ELClientJson::startValue(void) {
+  _inKey = false;
+  _tokLen = 0;
+  _tokTrunc = false;
+  _num = JSON_N_NONE;
+  _strOut = NULL;
+  _strLen = 0;
+}
+
+/*! endValue(void)
+@brief Continue after a complete value
+@note Internal library function
+*/
+void ELClientJson::endValue(void) {
+  _strOut = NULL;
+  _state = _depth == 0 ? JSON_S_DONE : JSON_S_NEXT;
+}
+
+/*! endScalar(void)
+@brief Complete a number, true, false or null
+@note Internal library function
+*/
+void ELClientJson::endScalar(void) {
+  _tok[_tokLen] = 0;
+  JSON_EVENT event;
+  if (_num != JSON_N_NONE) {
+    // a number must not end after its sign, dot or exponent
+    if (_num != JSON_N_ZERO && _num != JSON_N_INT && _num != JSON_N_FRAC && _num != JSON_N_EXP) {
+      _state = JSON_S_ERROR;
+      return;
+    }
+    event = JSON_EVENT_NUMBER;
+  } else if (strcmp(_tok, "true") == 0 || strcmp(_tok, "false") == 0) {
+    event = JSON_EVENT_BOOL;
+  } else if (strcmp(_tok, "null") == 0) {
+    event = JSON_EVENT_NULL;
+  } else {
+    _state = JSON_S_ERROR;
+    return;
+  }
+  emit(event);
+  bind(event);
+  endValue();
+}
+
+/*! numberChar(char c)
+@brief Check the next character of a number
+@details Follows the JSON number grammar: an optional minus, 0 or digits without a leading zero,
+  an optional fraction and an optional exponent. The whole number is checked as it arrives, so
+  numbers longer than JSON_TOKEN_MAX are checked too. Sets _num to JSON_N_BAD if the character
+  can't follow.
+@note Internal library function
+@param c
+  Character
+*/
+void ELClientJson::numberChar(char c) {
+  boolean digit = c >= '0' && c <= '9';
+  boolean exp = c == 'e' || c == 'E';
+  switch (_num) {
+  case JSON_N_START:
+    if (c == '-') {
+      _num = JSON_N_SIGN;
+      break;
+    }
+    // fall through
+  case JSON_N_SIGN:
+    _num = c == '0' ? JSON_N_ZERO : digit ? JSON_N_INT : JSON_N_BAD;
+    break;
+  case JSON_N_INT:
+    if (digit) break;
+    // fall through
+  case JSON_N_ZERO:
+    _num = c == '.' ? JSON_N_DOT : exp ? JSON_N_E : JSON_N_BAD;
+    break;
+  case JSON_N_DOT:
+    _num = digit ? JSON_N_FRAC : JSON_N_BAD;
+    break;
+  case JSON_N_FRAC:
+    if (!digit) _num = exp ? JSON_N_E : JSON_N_BAD;
+    break;
+  case JSON_N_E:
+    _num = c == '+' || c == '-' ? JSON_N_EXP_SIGN : digit ? JSON_N_EXP : JSON_N_BAD;
+    break;
+  case JSON_N_EXP_SIGN:
+    _num = digit ? JSON_N_EXP : JSON_N_BAD;
+    break;
+  case JSON_N_EXP:
+    if (!digit) _num = JSON_N_BAD;
+    break;
+  }
+}
+
+/*! emit(JSON_EVENT event)
+@brief Call eventCb
+@note Internal library function
+@param event
+  What was parsed
+*/
+void ELClientJson::emit(JSON_EVENT event) {
+  if (!eventCb.attached()) return;
+  ELClientJsonEvent ev;
+  ev.event = event;
+  boolean container = event <= JSON_EVENT_END_ARRAY;
+  ev.value = container ? NULL : _tok;
+  ev.len = container ? 0 : _tokLen;
+  ev.truncated = container ? false : _tokTrunc;
+  ev.depth = _depth;
+  eventCb(&ev);
+}
+
+/*! bind(JSON_EVENT event)
+@brief Set the variables bound to the path of the value just parsed
+@note Internal library function
+@param event
+  Type of the value
+*/
+void ELClientJson::bind(JSON_EVENT event) {
+  if (event == JSON_EVENT_NULL) return;
+  for (uint8_t i=0; i<_bindCount; i++) {
+    ELClientJsonBinding* b = &_bindings[i];
+    if (b == _strOut || !matchBinding(b)) continue;
+    switch (b->type) {
+    case JSON_INT:
+      *(int32_t*)b->out = event == JSON_EVENT_BOOL ? _tok[0] == 't' : atol(_tok);
+      break;
+    case JSON_FLOAT:
+      *(float*)b->out = event == JSON_EVENT_BOOL ? _tok[0] == 't' : atof(_tok);
+      break;
+    case JSON_BOOL:
+      *(boolean*)b->out = event == JSON_EVENT_BOOL ? _tok[0] == 't' : atof(_tok) != 0;
+      break;
+    case JSON_STRING:
+      if (b->size == 0) continue;
+      strncpy((char*)b->out, _tok, b->size - 1);
+      ((char*)b->out)[b->size - 1] = 0;
+      break;
+    default:
+      continue;
+    }
+    b->found = true;
+  }
+}
+
+/*! matchBinding(ELClientJsonBinding* b)
+@brief Check whether the value being parsed is at the path of a binding
+@details match() compares the hashes of the keys, which the document could make collide, so
+  the keys of all objects on the path must also have been equal to the ones in the path.
+@note Internal library function
+@param b
+  Binding
+@return <code>boolean</code>
+  True if the value is at the path
+*/
+boolean ELClientJson::matchBinding(ELClientJsonBinding* b) {
+  if (!match(b->path)) return false;
+  uint8_t objects = ~_isArray & (uint8_t)((1 << _depth) - 1);
+  return (b->keys & objects) == objects;
+}
+
+/*! compareKey(char c)
+@brief Compare the next character of a key with the keys in the paths of the bindings
+@note Internal library function
+@param c
+  Character, 0 at the end of the key
+*/
+void ELClientJson::compareKey(char c) {
+  for (uint8_t i=0; i<_bindCount; i++) {
+    ELClientJsonBinding* b = &_bindings[i];
+    if (b->keyPos == 0xFF) continue;
+    char p = b->path[b->keyPos];
+    if (p == '.' || p == '[') p = 0;
+    if (p != c) {
+      b->keyPos = 0xFF;
+    } else if (c != 0) {
+      b->keyPos++;
+    } else {
+      b->keys |= 1 << (_depth-1);
+    }
+  }
+}
+
+/*! keyStart(const char* path, uint8_t level)
+@brief Find the key at a level of a path
+@note Internal library function
+@param path
+  Path, e.g. "weather[0].id"
+@param level
+  Nesting level, 0 for the top-level value
+@return <code>uint8_t</code>
+  Offset of the key in the path, 0xFF if there is an index or nothing at that level
+*/
+uint8_t ELClientJson::keyStart(const char* path, uint8_t level) {
+  const char* p = path;
+  for (uint8_t l=0; *p != 0; l++) {
+    if (*p == '[') {
+      if (l == level) return 0xFF;
+      while (*p != 0 && *p != ']') p++;
+      if (*p == ']') p++;
+    } else {
+      if (*p == '.') p++;
+      if (l == level) return p - path < 0xFF ? p - path : 0xFF;
+      while (*p != 0 && *p != '.' && *p != '[') p++;
+    }
+  }
+  return 0xFF;
+}
+
+/*! restChunk(void* chunk)
+@brief Parse a streamed REST response
+@details Starts a new document with each response.
+@param chunk
+  Pointer to an ELClientRestChunk
+@par Example
+@code
+  rest.chunkCb.attach(&json, &ELClientJson::restChunk);
+@endcode
+*/
+void ELClientJson::restChunk(void* chunk) {
+  ELClientRestChunk* c = (ELClientRestChunk*)chunk;
+  switch (c->event) {
+  case REST_STATUS: reset(); break;
+  case REST_BODY:   feed(c->data, c->len); break;
+  case REST_DONE:   finish(); break;
+  }
+}
+
+/*! mqttChunk(void* chunk)
+@brief Parse an MQTT message or fragment
+@details Starts a new document with the first fragment of each message.
+@param chunk
+  Pointer to an ELClientMqttChunk
+@par Example
+@code
+  mqtt.chunkCb.attach(&json, &ELClientJson::mqttChunk);
+@endcode
+*/
+void ELClientJson::mqttChunk(void* chunk) {
+  ELClientMqttChunk* c = (ELClientMqttChunk*)chunk;
+  if (c->offset == 0) reset();
+  feed(c->data, c->len);
+  if (c->offset + c->len >= c->total) finish();
+}
+
+/*! mqttData(void* response)
+@brief Parse an MQTT message
+@param response
+  Pointer to the ELClientResponse passed to ELClientMqtt::dataCb
+@par Example
+@code
+  mqtt.dataCb.attach(&json, &ELClientJson::mqttData);
+@endcode
+*/
+void ELClientJson::mqttData(void* response) {
+  ELClientResponse* resp = (ELClientResponse*)response;
+  void* data;
+  resp->popArgPtr(&data); // topic
+  uint16_t len = resp->popArgPtr(&data);
+  reset();
+  feed((const uint8_t*)data, len);
+  finish();
+}
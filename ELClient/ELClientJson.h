@@ -0,0 +1,142 @@
+/*! \file ELClientJson.h
+    \brief Definitions for ELClientJson
+*/
+// Incremental event-driven JSON parser for REST responses and MQTT messages
+
+#ifndef _EL_CLIENT_JSON_H_
+#define _EL_CLIENT_JSON_H_
+
+#include <Arduino.h>
+#include "FP.h"
+#include "ELClient.h"
+
+#define JSON_MAX_DEPTH 8  /**< Maximum nesting of objects and arrays */
+#define JSON_TOKEN_MAX 24 /**< Maximum length of a number or string held for events and conversion */
+
+// Type of the variable a path is bound to
+typedef enum {
+  JSON_INT = 0,   /**< int32_t */
+  JSON_FLOAT,     /**< float */
+  JSON_BOOL,      /**< boolean */
+  JSON_STRING     /**< char buffer of the given size, null-terminated */
+} JSON_TYPE;
+
+// Binding of a path to a variable, the path consists of object keys separated by dots and of
+// array indexes in brackets, e.g. "main.temp" or "weather[0].id" or "[2]". The variable is set
+// when the value at the path has been parsed and found is set to true.
+typedef struct {
+  const char* path;  /**< Path of the value */
+  uint8_t type;      /**< Type of the variable, see JSON_TYPE */
+  void* out;         /**< Pointer to the variable */
+  uint16_t size;     /**< JSON_STRING: size of the buffer at out */
+  boolean found;     /**< The value has been found since reset */
+  uint8_t keys;      /**< Used by the parser: levels whose current key equals the key in the path */
+  uint8_t keyPos;    /**< Used by the parser: position in the path of the key being compared, 0xFF if it differs */
+} ELClientJsonBinding;
+
+typedef enum {
+  JSON_EVENT_OBJECT = 0, /**< Start of an object */
+  JSON_EVENT_END_OBJECT, /**< End of an object */
+  JSON_EVENT_ARRAY,      /**< Start of an array */
+  JSON_EVENT_END_ARRAY,  /**< End of an array */
+  JSON_EVENT_STRING,     /**< String value */
+  JSON_EVENT_NUMBER,     /**< Number value */
+  JSON_EVENT_BOOL,       /**< true or false */
+  JSON_EVENT_NULL        /**< null */
+} JSON_EVENT;
+
+// Event passed to eventCb, use ELClientJson::match to check where in the document it occurred
+typedef struct {
+  JSON_EVENT event;      /**< What was parsed */
+  const char* value;     /**< Text of the value, null-terminated, NULL for objects and arrays */
+  uint8_t len;           /**< Length of the text */
+  boolean truncated;     /**< The text was longer than JSON_TOKEN_MAX */
+  uint8_t depth;         /**< Nesting depth of the value, 0 for the top-level value */
+} ELClientJsonEvent;
+
+// ELClientJson parses a JSON document piece by piece as it arrives, so it never needs the whole
+// document in RAM: it only keeps one number or string of up to JSON_TOKEN_MAX characters and a
+// small stack describing where in the document it is. Values are delivered by setting bound
+// variables and by calling eventCb. Strings bound to a JSON_STRING variable are copied straight
+// into its buffer, so they can be longer than JSON_TOKEN_MAX.
+// It can be fed directly from ELClientRest::chunkCb and from ELClientMqtt::chunkCb or dataCb by
+// attaching restChunk, mqttChunk or mqttData.
+class ELClientJson {
+  public:
+    ELClientJson();
+
+    // Bind paths to variables, the array must remain valid
+    void setBindings(ELClientJsonBinding* bindings, uint8_t count);
+
+    // Start a new document, clears the found flags of the bindings
+    void reset(void);
+    // Parse the next piece of the document, returns false if it has a syntax error
+    boolean feed(const uint8_t* data, uint16_t len);
+    // Signal the end of the document, needed to complete a top-level number
+    boolean finish(void);
+
+    // True once a complete document has been parsed
+    boolean done(void) { return _state == JSON_S_DONE; }
+    // True if the document has a syntax error or is nested too deeply
+    boolean error(void) { return _state == JSON_S_ERROR; }
+
+    // True if the value being parsed is at path, for use in eventCb. Keys are compared by a
+    // 16-bit hash, the paths of bindings are compared exactly.
+    boolean match(const char* path);
+
+    // Callback for every value, called with a pointer to an ELClientJsonEvent
+    FP<void, void*> eventCb;
+
+    // Parse a streamed REST response, attach to ELClientRest::chunkCb
+    void restChunk(void* chunk);
+    // Parse MQTT messages and fragments, attach to ELClientMqtt::chunkCb
+    void mqttChunk(void* chunk);
+    // Parse MQTT messages, attach to ELClientMqtt::dataCb
+    void mqttData(void* response);
+
+  private:
+    typedef enum {
+      JSON_S_VALUE = 0, JSON_S_VALUE_OR_END, JSON_S_KEY_OR_END, JSON_S_MEMBER, JSON_S_KEY, JSON_S_COLON,
+      JSON_S_STRING, JSON_S_ESCAPE, JSON_S_UNICODE, JSON_S_SCALAR, JSON_S_NEXT, JSON_S_DONE, JSON_S_ERROR
+    } JSON_STATE;
+
+    // Position within a number, for checking it against the JSON number grammar
+    typedef enum {
+      JSON_N_NONE = 0, JSON_N_START, JSON_N_SIGN, JSON_N_ZERO, JSON_N_INT, JSON_N_DOT, JSON_N_FRAC,
+      JSON_N_E, JSON_N_EXP_SIGN, JSON_N_EXP, JSON_N_BAD
+    } JSON_NUMBER;
+
+    boolean put(char c);
+    void numberChar(char c);
+    void addChar(char c);
+    void startValue(void);
+    void endValue(void);
+    void endScalar(void);
+    void emit(JSON_EVENT event);
+    void bind(JSON_EVENT event);
+    boolean matchBinding(ELClientJsonBinding* b);
+    void compareKey(char c);
+    static uint8_t keyStart(const char* path, uint8_t level);
+    static uint16_t hashAdd(uint16_t hash, char c) { return ((hash << 5) + hash) ^ (uint8_t)c; }
+
+    ELClientJsonBinding* _bindings; /**< Bindings, NULL if none */
+    uint8_t _bindCount;   /**< Number of bindings */
+
+    uint8_t _state;       /**< Parser state, see JSON_STATE */
+    boolean _inKey;       /**< The string being parsed is a key */
+    uint8_t _depth;       /**< Number of open objects and arrays */
+    uint8_t _isArray;     /**< Bit mask of the open containers that are arrays */
+    uint16_t _pos[JSON_MAX_DEPTH]; /**< Key hash or array index within each open container */
+
+    char _tok[JSON_TOKEN_MAX+1]; /**< Current number or string */
+    uint8_t _tokLen;      /**< Length of the current number or string */
+    boolean _tokTrunc;    /**< The current number or string did not fit */
+    uint8_t _num;         /**< Position within the current number, see JSON_NUMBER, JSON_N_NONE for true, false and null */
+    uint16_t _unicode;    /**< Code point of a \\u escape */
+    uint8_t _unicodeLen;  /**< Number of hex digits of a \\u escape parsed */
+
+    ELClientJsonBinding* _strOut; /**< Binding the current string is copied into, NULL if none */
+    uint16_t _strLen;     /**< Number of bytes copied into _strOut */
+};
+
+#endif // _EL_CLIENT_JSON_H_
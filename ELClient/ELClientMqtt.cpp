@@ -8,6 +8,7 @@
 
 #include <Arduino.h>
 #include "ELClientMqtt.h"
+#include "ELClientOutbox.h"
 
 // constructor
 /*! ELClientMqtt(ELClient* elc)
@@ -17,11 +18,27 @@
   ELClientMqtt(ELClient* elc);
 @endcode
 */
-ELClientMqtt::ELClientMqtt(ELClient* elc) :_elc(elc) {}
+ELClientMqtt::ELClientMqtt(ELClient* elc) :_elc(elc), _connected(false), _prefix(0),
+    _prefixFlash(false), _prefixRemote(false), _setupDone(false), _outbox(0), _msgBuf(0), _msgSize(0), _msgActive(false) {
+  _connectedCb.attach(this, &ELClientMqtt::connectedCallback);
+  _disconnectedCb.attach(this, &ELClientMqtt::disconnectedCallback);
+  _dataCb.attach(this, &ELClientMqtt::dataCallback);
+  _prefixCb.attach(this, &ELClientMqtt::prefixCallback);
+}
+
+// topic prefix and relative topic, for printing them as one absolute topic
+typedef struct {
+  const char* prefix;
+  boolean prefixFlash;
+  const char* topic;
+  boolean topicFlash;
+} TopicParts;
 
 /*! setup(void)
 @brief Setup mqtt
-@details Send callback functions for MQTT events to the ESP
+@details Send callback functions for MQTT events to the ESP. If chunkCb is attached or a message
+  buffer has been set, the size of the protocol buffer is sent along so esp-link delivers messages
+  that don't fit in fragments.
 @par Example
 @code
   mqtt.connectedCb.attach(mqttConnected);
@@ -33,18 +50,606 @@ ELClientMqtt::ELClientMqtt(ELClient* elc) :_elc(elc) {}
 */
 void ELClientMqtt::setup(void) {
   Serial.print(F("ConnectedCB is 0x")); Serial.println((uint32_t)&connectedCb, 16);
-  _elc->Request(CMD_MQTT_SETUP, 0, 4);
-  uint32_t cb = (uint32_t)&connectedCb;
+  boolean frag = chunkCb.attached() || _msgBuf != NULL;
+  _elc->Request(CMD_MQTT_SETUP, 0, frag ? 5 : 4);
+  uint32_t cb = (uint32_t)&_connectedCb;
   _elc->Request(&cb, 4);
-  cb = (uint32_t)&disconnectedCb;
+  cb = (uint32_t)&_disconnectedCb;
   _elc->Request(&cb, 4);
   cb = (uint32_t)&publishedCb;
   _elc->Request(&cb, 4);
-  cb = (uint32_t)&dataCb;
+  cb = (uint32_t)&_dataCb;
   _elc->Request(&cb, 4);
+  if (frag) _elc->Request(&_elc->_proto.bufSize, 2);
+  _elc->Request();
+  _connected = false;
+  _msgActive = false;
+  _setupDone = true;
+  registerPrefix();
+}
+
+/*! connectedCallback(void* res)
+@brief Track that MQTT is connected and pass the event on to connectedCb
+@note Internal library function
+@param res
+  Pointer to ELClientResponse structure
+*/
+void ELClientMqtt::connectedCallback(void* res) {
+  _connected = true;
+  connectedCb(res);
+}
+
+/*! disconnectedCallback(void* res)
+@brief Track that MQTT is disconnected and pass the event on to disconnectedCb
+@note Internal library function
+@param res
+  Pointer to ELClientResponse structure
+*/
+void ELClientMqtt::disconnectedCallback(void* res) {
+  _connected = false;
+  disconnectedCb(res);
+}
+
+/*! setMessageBuffer(uint8_t* buf, uint16_t size)
+@brief Set a buffer to reassemble fragmented messages
+@details Messages that are larger than the protocol buffer are sent by esp-link in fragments.
+  The fragments are reassembled in the buffer, which holds the null-terminated topic followed by
+  the message. When the last fragment has arrived messageCb is called. If the message doesn't fit
+  the excess is dropped and the truncated flag is set. Must be called before setup.
+@param buf
+  Pointer to the reassembly buffer, NULL to disable reassembly
+@param size
+  Size of the reassembly buffer
+@par Example
+@code
+  uint8_t msgBuf[300];
+
+  void mqttMessage(void* m) {
+    ELClientMqttChunk *msg = (ELClientMqttChunk*)m;
+    Serial.print(msg->topic);
+    Serial.print(" = ");
+    Serial.println((char*)msg->data);
+  }
+
+  mqtt.messageCb.attach(mqttMessage);
+  mqtt.setMessageBuffer(msgBuf, sizeof(msgBuf));
+  mqtt.setup();
+@endcode
+*/
+void ELClientMqtt::setMessageBuffer(uint8_t* buf, uint16_t size) {
+  _msgBuf = size > 0 ? buf : NULL;
+  _msgSize = size;
+  _msgActive = false;
+}
+
+/*! dataCallback(void* res)
+@brief Handle a received message or message fragment
+@details Unfragmented messages are passed to dataCb as-is. All messages and fragments are passed
+  to chunkCb and reassembled in the message buffer, if these are set.
+@note Internal library function
+@param res
+  Pointer to ELClientResponse structure
+*/
+void ELClientMqtt::dataCallback(void* res) {
+  if (!res) return;
+  ELClientResponse *resp = (ELClientResponse *)res;
+
+  if (resp->argc() < 4 && dataCb.attached()) {
+    ELClientResponse copy = *resp; // leave the args for the fragment handling below
+    dataCb(&copy);
+  }
+  if (!chunkCb.attached() && _msgBuf == NULL) return;
+
+  ELClientMqttChunk chunk;
+  chunk.topicLen = resp->popArgPtr((void**)&chunk.topic);
+  chunk.len = resp->popArgPtr((void**)&chunk.data);
+  chunk.offset = 0;
+  chunk.total = chunk.len;
+  chunk.truncated = false;
+  if (resp->argc() >= 4) {
+    resp->popArg(&chunk.offset, 2);
+    resp->popArg(&chunk.total, 2);
+  }
+
+  if (chunkCb.attached()) chunkCb(&chunk);
+  if (_msgBuf != NULL) reassemble(&chunk);
+}
+
+/*! reassemble(ELClientMqttChunk* chunk)
+@brief Append a message fragment to the message buffer
+@details A fragment with offset 0 starts a new message, a fragment that doesn't continue the
+  current message means a fragment got lost and the message is dropped. When the message is
+  complete messageCb is called.
+@note Internal library function
+@param chunk
+  Received fragment
+*/
+void ELClientMqtt::reassemble(ELClientMqttChunk* chunk) {
+  if (chunk->offset == 0) {
+    uint16_t tl = chunk->topicLen < _msgSize ? chunk->topicLen : _msgSize - 1;
+    memcpy(_msgBuf, chunk->topic, tl);
+    _msgBuf[tl] = 0;
+    _msgTopicLen = tl;
+    _msgLen = 0;
+    _msgTotal = chunk->total;
+    _msgNext = 0;
+    _msgTrunc = tl < chunk->topicLen;
+    _msgActive = true;
+  } else if (!_msgActive || chunk->offset != _msgNext || chunk->total != _msgTotal) {
+    if (_msgActive && _elc->_debugEn) _elc->_debug->println(F("MQTT: lost fragment"));
+    _msgActive = false;
+    return;
+  }
+
+  uint8_t *dst = _msgBuf + _msgTopicLen + 1 + _msgLen;
+  uint16_t room = _msgSize - _msgTopicLen - 1 - _msgLen;
+  uint16_t n = chunk->len < room ? chunk->len : room;
+  memcpy(dst, chunk->data, n);
+  _msgLen += n;
+  if (n < chunk->len) _msgTrunc = true;
+  _msgNext += chunk->len;
+  if (_msgNext < _msgTotal) return;
+
+  // message complete, null-terminate it if there is room
+  if (_msgTopicLen + 1 + _msgLen < _msgSize) _msgBuf[_msgTopicLen + 1 + _msgLen] = 0;
+  ELClientMqttChunk msg;
+  msg.topic = (const char*)_msgBuf;
+  msg.topicLen = _msgTopicLen;
+  msg.data = _msgBuf + _msgTopicLen + 1;
+  msg.len = _msgLen;
+  msg.offset = 0;
+  msg.total = _msgTotal;
+  msg.truncated = _msgTrunc;
+  _msgActive = false;
+  messageCb(&msg);
+}
+
+// TOPIC PREFIX
+
+/*! setPrefix(const char* prefix)
+@brief Set the topic prefix for relative topics
+@details Registers the prefix with esp-link, which stores it and prepends it to the topics of
+  relative publish and subscribe requests, so the prefix doesn't have to be sent in every frame
+  nor stored in flash with every topic string. Until esp-link confirms the prefix, which older
+  versions never do, the prefix is prepended locally. The prefix is registered by setup, which
+  also registers it again after esp-link resets. Once setup was called a new prefix is registered
+  right away.
+@param prefix
+  Topic prefix, must remain valid, NULL to remove the prefix
+@par Example
+@code
+  mqtt.setPrefix("/esp-link/1/");
+  mqtt.subscribe(MQTT_RELATIVE, "cmd/#");       // subscribes to /esp-link/1/cmd/#
+  mqtt.publish(MQTT_RELATIVE, "temp", "21.5");  // publishes to /esp-link/1/temp
+@endcode
+*/
+void ELClientMqtt::setPrefix(const char* prefix) {
+  _prefix = prefix;
+  _prefixFlash = false;
+  _prefixRemote = false;
+  if (_setupDone) registerPrefix();
+}
+
+/*! setPrefix(const __FlashStringHelper* prefix)
+@brief Set the topic prefix for relative topics
+@details Same as above with the prefix stored in program memory
+@param prefix
+  Topic prefix
+@par Example
+@code
+  mqtt.setPrefix(F("/esp-link/1/"));
+@endcode
+*/
+void ELClientMqtt::setPrefix(const __FlashStringHelper* prefix) {
+  _prefix = (const char*)prefix;
+  _prefixFlash = true;
+  _prefixRemote = false;
+  if (_setupDone) registerPrefix();
+}
+
+/*! registerPrefix(void)
+@brief Send the topic prefix to esp-link
+@details esp-link confirms that it stores the prefix with a callback, until then the prefix is
+  prepended locally.
+@note Internal library function
+*/
+void ELClientMqtt::registerPrefix(void) {
+  _prefixRemote = false;
+  if (_prefix == NULL) return;
+  _elc->Request(CMD_MQTT_PREFIX, (uint32_t)&_prefixCb, 1);
+  if (_prefixFlash) _elc->Request((const __FlashStringHelper*)_prefix, strlen_P(_prefix));
+  else              _elc->Request(_prefix, strlen(_prefix));
+  _elc->Request();
+}
+
+/*! prefixCallback(void* res)
+@brief esp-link confirmed that it stores the topic prefix
+@note Internal library function
+@param res
+  Pointer to ELClientResponse structure
+*/
+void ELClientMqtt::prefixCallback(void*) {
+  _prefixRemote = true;
+}
+
+/*! printTopic(Print* out, uint16_t chunk, void* ctx)
+@brief Producer that prints a topic prefix followed by a relative topic
+@note Internal library function
+*/
+boolean ELClientMqtt::printTopic(Print* out, uint16_t, void* ctx) {
+  TopicParts* t = (TopicParts*)ctx;
+  if (t->prefixFlash) out->print((const __FlashStringHelper*)t->prefix);
+  else                out->print(t->prefix);
+  if (t->topicFlash) out->print((const __FlashStringHelper*)t->topic);
+  else               out->print(t->topic);
+  return false;
+}
+
+/*! requestTopic(uint16_t cmd, uint16_t argc, const char* topic, boolean flash)
+@brief Start a request with a relative topic as first argument
+@details If esp-link stores the prefix the relative topic is sent as-is and flagged as relative in
+  the value of the request, otherwise the prefix is prepended locally.
+@note Internal library function
+*/
+void ELClientMqtt::requestTopic(uint16_t cmd, uint16_t argc, const char* topic, boolean flash) {
+  if (_prefix == NULL || _prefixRemote) {
+    _elc->Request(cmd, _prefix != NULL ? MQTT_RELATIVE : 0, argc);
+    if (flash) _elc->Request((const __FlashStringHelper*)topic, strlen_P(topic));
+    else       _elc->Request(topic, strlen(topic));
+    return;
+  }
+  TopicParts parts = { _prefix, _prefixFlash, topic, flash };
+  uint16_t len = (_prefixFlash ? strlen_P(_prefix) : strlen(_prefix)) +
+      (flash ? strlen_P(topic) : strlen(topic));
+  _elc->Request(cmd, 0, argc);
+  _elc->Request(&ELClientMqtt::printTopic, &parts, len);
+}
+
+/*! subscribe(MQTT_TOPIC rel, const char* topic, uint8_t qos)
+@brief Subscribe to a topic relative to the topic prefix
+@param rel
+  MQTT_RELATIVE
+@param topic
+  Topic name relative to the prefix
+@param qos
+  (optional) Requested qos level, default 0
+@par Example
+@code
+  mqtt.subscribe(MQTT_RELATIVE, "cmd/#");
+@endcode
+*/
+void ELClientMqtt::subscribe(MQTT_TOPIC, const char* topic, uint8_t qos) {
+  requestTopic(CMD_MQTT_SUBSCRIBE, 2, topic, false);
+  _elc->Request(&qos, 1);
   _elc->Request();
 }
 
+/*! subscribe(MQTT_TOPIC rel, const __FlashStringHelper* topic, uint8_t qos)
+@brief Subscribe to a topic relative to the topic prefix
+@details Same as above with the topic stored in program memory
+@param rel
+  MQTT_RELATIVE
+@param topic
+  Topic name relative to the prefix
+@param qos
+  (optional) Requested qos level, default 0
+@par Example
+@code
+  mqtt.subscribe(MQTT_RELATIVE, F("cmd/#"));
+@endcode
+*/
+void ELClientMqtt::subscribe(MQTT_TOPIC, const __FlashStringHelper* topic, uint8_t qos) {
+  requestTopic(CMD_MQTT_SUBSCRIBE, 2, (const char*)topic, true);
+  _elc->Request(&qos, 1);
+  _elc->Request();
+}
+
+/*! publish(MQTT_TOPIC rel, const char* topic, const uint8_t* data, const uint16_t len, uint8_t qos, uint8_t retain)
+@brief Publish to a topic relative to the topic prefix
+@param rel
+  MQTT_RELATIVE
+@param topic
+  Topic name relative to the prefix
+@param data
+  Pointer to data buffer
+@param len
+  Size of data buffer
+@param qos
+  (optional) Requested qos level, default 0
+@param retain
+  (optional) Requested retain level, default 0
+@par Example
+@code
+  uint8_t sample[4];
+  mqtt.publish(MQTT_RELATIVE, "raw", sample, sizeof(sample));
+@endcode
+*/
+void ELClientMqtt::publish(MQTT_TOPIC, const char* topic, const uint8_t* data,
+    const uint16_t len, uint8_t qos, uint8_t retain)
+{
+  if (queue(topic, false, true, data, false, len, qos, retain)) return;
+  requestTopic(CMD_MQTT_PUBLISH, 5, topic, false);
+  _elc->Request(data, len);
+  _elc->Request(&len, 2);
+  _elc->Request(&qos, 1);
+  _elc->Request(&retain, 1);
+  _elc->Request();
+}
+
+/*! publish(MQTT_TOPIC rel, const char* topic, const char* data, uint8_t qos, uint8_t retain)
+@brief Publish to a topic relative to the topic prefix
+@details Data must be null-terminated
+@param rel
+  MQTT_RELATIVE
+@param topic
+  Topic name relative to the prefix
+@param data
+  Pointer to data buffer
+@param qos
+  (optional) Requested qos level, default 0
+@param retain
+  (optional) Requested retain level, default 0
+@par Example
+@code
+  mqtt.publish(MQTT_RELATIVE, "temp", "21.5");
+@endcode
+*/
+void ELClientMqtt::publish(MQTT_TOPIC rel, const char* topic, const char* data,
+    uint8_t qos, uint8_t retain)
+{
+  publish(rel, topic, (const uint8_t*)data, strlen(data), qos, retain);
+}
+
+/*! publish(MQTT_TOPIC rel, const __FlashStringHelper* topic, const uint8_t* data, const uint16_t len, uint8_t qos, uint8_t retain)
+@brief Publish to a topic relative to the topic prefix
+@details Same as above with the topic stored in program memory
+@param rel
+  MQTT_RELATIVE
+@param topic
+  Topic name relative to the prefix
+@param data
+  Pointer to data buffer
+@param len
+  Size of data buffer
+@param qos
+  (optional) Requested qos level, default 0
+@param retain
+  (optional) Requested retain level, default 0
+@par Example
+@code
+  mqtt.publish(MQTT_RELATIVE, F("raw"), sample, sizeof(sample));
+@endcode
+*/
+void ELClientMqtt::publish(MQTT_TOPIC, const __FlashStringHelper* topic, const uint8_t* data,
+    const uint16_t len, uint8_t qos, uint8_t retain)
+{
+  if (queue((const char*)topic, true, true, data, false, len, qos, retain)) return;
+  requestTopic(CMD_MQTT_PUBLISH, 5, (const char*)topic, true);
+  _elc->Request(data, len);
+  _elc->Request(&len, 2);
+  _elc->Request(&qos, 1);
+  _elc->Request(&retain, 1);
+  _elc->Request();
+}
+
+/*! publish(MQTT_TOPIC rel, const __FlashStringHelper* topic, const char* data, uint8_t qos, uint8_t retain)
+@brief Publish to a topic relative to the topic prefix
+@details Same as above with the topic stored in program memory, data must be null-terminated
+@param rel
+  MQTT_RELATIVE
+@param topic
+  Topic name relative to the prefix
+@param data
+  Pointer to data buffer
+@param qos
+  (optional) Requested qos level, default 0
+@param retain
+  (optional) Requested retain level, default 0
+@par Example
+@code
+  mqtt.publish(MQTT_RELATIVE, F("temp"), "21.5");
+@endcode
+*/
+void ELClientMqtt::publish(MQTT_TOPIC rel, const __FlashStringHelper* topic, const char* data,
+    uint8_t qos, uint8_t retain)
+{
+  publish(rel, topic, (const uint8_t*)data, strlen(data), qos, retain);
+}
+
+/*! publish(MQTT_TOPIC rel, const char* topic, ELClientProducer producer, void* ctx, uint16_t len, uint8_t qos, uint8_t retain)
+@brief Publish a message generated by a producer to a topic relative to the topic prefix
+@param rel
+  MQTT_RELATIVE
+@param topic
+  Topic name relative to the prefix
+@param producer
+  Function that prints the payload, see ELClientProducer
+@param ctx
+  Context pointer passed to the producer
+@param len
+  (optional) Length of the payload, 0 to measure it with a dry-run of the producer
+@param qos
+  (optional) Requested qos level, default 0
+@param retain
+  (optional) Requested retain level, default 0
+@par Example
+@code
+  mqtt.publish(MQTT_RELATIVE, "telemetry", readingJson, &reading);
+@endcode
+*/
+void ELClientMqtt::publish(MQTT_TOPIC, const char* topic, ELClientProducer producer,
+    void* ctx, uint16_t len, uint8_t qos, uint8_t retain)
+{
+  if (queue(topic, false, true, producer, ctx, len, qos, retain)) return;
+  requestTopic(CMD_MQTT_PUBLISH, 5, topic, false);
+  len = _elc->Request(producer, ctx, len);
+  _elc->Request(&len, 2);
+  _elc->Request(&qos, 1);
+  _elc->Request(&retain, 1);
+  _elc->Request();
+}
+
+/*! publish(MQTT_TOPIC rel, const __FlashStringHelper* topic, ELClientProducer producer, void* ctx, uint16_t len, uint8_t qos, uint8_t retain)
+@brief Publish a message generated by a producer to a topic relative to the topic prefix
+@details Same as above with the topic stored in program memory
+@param rel
+  MQTT_RELATIVE
+@param topic
+  Topic name relative to the prefix
+@param producer
+  Function that prints the payload, see ELClientProducer
+@param ctx
+  Context pointer passed to the producer
+@param len
+  (optional) Length of the payload, 0 to measure it with a dry-run of the producer
+@param qos
+  (optional) Requested qos level, default 0
+@param retain
+  (optional) Requested retain level, default 0
+@par Example
+@code
+  mqtt.publish(MQTT_RELATIVE, F("telemetry"), readingJson, &reading);
+@endcode
+*/
+void ELClientMqtt::publish(MQTT_TOPIC, const __FlashStringHelper* topic, ELClientProducer producer,
+    void* ctx, uint16_t len, uint8_t qos, uint8_t retain)
+{
+  if (queue((const char*)topic, true, true, producer, ctx, len, qos, retain)) return;
+  requestTopic(CMD_MQTT_PUBLISH, 5, (const char*)topic, true);
+  len = _elc->Request(producer, ctx, len);
+  _elc->Request(&len, 2);
+  _elc->Request(&qos, 1);
+  _elc->Request(&retain, 1);
+  _elc->Request();
+}
+
+// OUTBOX
+
+/*! setOutbox(ELClientOutbox* outbox, uint16_t drainInterval, uint8_t drainBurst)
+@brief Store messages in an outbox while MQTT is disconnected
+@details While esp-link reports that MQTT is disconnected, and before it first reports a connection,
+  published messages are stored in the outbox instead of being passed to esp-link. After
+  connectedCb the outbox is drained from ELClient::Process() at a controlled rate, messages
+  published meanwhile are queued behind the stored ones to preserve the order. Each of them first
+  sends two stored messages, so the backlog shrinks with every publish even when messages are
+  published faster than the outbox is drained, and at most as many messages as were stored on
+  reconnecting go through the storage again. Messages that don't fit into an outbox slot are
+  dropped while disconnected, while connected the outbox is drained completely before they are
+  sent directly.
+@param outbox
+  Outbox to use, it must have been started with begin, NULL to stop using an outbox
+@param drainInterval
+  (optional) Time between draining bursts in milliseconds, default 100
+@param drainBurst
+  (optional) Number of messages sent per draining burst, default 1
+@par Example
+@code
+  ELClientEEPROMStorage storage(512, 512);
+  ELClientOutbox outbox(&storage, 64);
+
+  void setup() {
+    ...
+    outbox.begin();
+    mqtt.setOutbox(&outbox, 200, 2); // drain 10 messages per second
+    mqtt.setup();
+  }
+
+  void loop() {
+    esp.Process();
+    ...
+    Serial.print("Outbox fill: ");
+    Serial.println(outbox.fill());
+  }
+@endcode
+*/
+void ELClientMqtt::setOutbox(ELClientOutbox* outbox, uint16_t drainInterval, uint8_t drainBurst) {
+  _outbox = outbox;
+  _drainInterval = drainInterval;
+  _drainBurst = drainBurst > 0 ? drainBurst : 1;
+  _drainAt = millis();
+  if (outbox != NULL) _elc->attachService(this);
+  else                _elc->detachService(this);
+}
+
+/*! queue(const char* topic, boolean topicFlash, boolean relative, const void* data, boolean dataFlash, uint16_t len, uint8_t qos, uint8_t retain)
+@brief Store a message with data in RAM or program memory in the outbox if it is not to be sent now
+@note Internal library function
+@return <code>boolean</code>
+  True if the message has been taken care of, false if it is to be sent now
+*/
+boolean ELClientMqtt::queue(const char* topic, boolean topicFlash, boolean relative, const void* data,
+    boolean dataFlash, uint16_t len, uint8_t qos, uint8_t retain)
+{
+  if (_outbox == NULL || (_connected && _outbox->count() == 0)) return false;
+  ELClientBlock block = { data, len, dataFlash };
+  return queue(topic, topicFlash, relative, &ELClient::PrintBlock, &block, len, qos, retain);
+}
+
+/*! queue(const char* topic, boolean topicFlash, boolean relative, ELClientProducer producer, void* ctx, uint16_t len, uint8_t qos, uint8_t retain)
+@brief Store a message generated by a producer in the outbox if it is not to be sent now
+@details Relative topics are stored with the prefix prepended.
+@note Internal library function
+@return <code>boolean</code>
+  True if the message has been taken care of, false if it is to be sent now
+*/
+boolean ELClientMqtt::queue(const char* topic, boolean topicFlash, boolean relative,
+    ELClientProducer producer, void* ctx, uint16_t len, uint8_t qos, uint8_t retain)
+{
+  if (_outbox == NULL || (_connected && _outbox->count() == 0)) return false;
+  if (!relative || _prefix == NULL) relative = false;
+  TopicParts parts = { relative ? _prefix : "", relative && _prefixFlash, topic, topicFlash };
+  uint16_t topicLen = (parts.prefixFlash ? strlen_P(parts.prefix) : strlen(parts.prefix)) +
+      (topicFlash ? strlen_P(topic) : strlen(topic));
+  if (len == 0) len = _elc->Measure(producer, ctx);
+  if (_connected) {
+    // catch up on the backlog ahead of this message, all of it if the message can't be stored
+    boolean fits = topicLen + len <= _outbox->maxMessage();
+    for (uint8_t i=0; (i<2 || !fits) && sendStored(); i++) ;
+    if (!fits || _outbox->count() == 0) return false;
+  }
+  uint8_t flags = (qos & OUTBOX_QOS_MASK) | (retain ? OUTBOX_RETAIN : 0);
+  return _outbox->push(flags, &ELClientMqtt::printTopic, &parts, topicLen, producer, ctx, len) ||
+      !_connected;
+}
+
+/*! service(uint32_t now)
+@brief Drain the outbox
+@details Sends up to drainBurst stored messages every drainInterval milliseconds while connected.
+@note Internal library function, called from ELClient::Process()
+@param now
+  Current time in milliseconds
+*/
+void ELClientMqtt::service(uint32_t now) {
+  if (_outbox == NULL || !_connected || _outbox->count() == 0) return;
+  if (now - _drainAt < _drainInterval) return;
+  _drainAt = now;
+
+  for (uint8_t i=0; i<_drainBurst && sendStored(); i++) ;
+}
+
+/*! sendStored(void)
+@brief Publish the oldest message in the outbox and remove it
+@note Internal library function
+@return <code>boolean</code>
+  False if the outbox is empty
+*/
+boolean ELClientMqtt::sendStored(void) {
+  ELClientOutboxEntry entry;
+  if (!_outbox->peek(&entry)) return false;
+  uint8_t qos = entry.flags & OUTBOX_QOS_MASK;
+  uint8_t retain = (entry.flags & OUTBOX_RETAIN) != 0;
+  uint16_t len = entry.data.len;
+  _elc->Request(CMD_MQTT_PUBLISH, 0, 5);
+  _elc->Request(&ELClientOutbox::printRange, &entry.topic, entry.topic.len);
+  _elc->Request(&ELClientOutbox::printRange, &entry.data, len);
+  _elc->Request(&len, 2);
+  _elc->Request(&qos, 1);
+  _elc->Request(&retain, 1);
+  _elc->Request();
+  _outbox->pop();
+  return true;
+}
+
 // LWT
 
 /*! lwt(const char* topic, const char* message, uint8_t qos, uint8_t retain)
@@ -173,6 +778,7 @@ void ELClientMqtt::subscribe(const __FlashStringHelper* topic, uint8_t qos) {
 void ELClientMqtt::publish(const char* topic, const uint8_t* data, const uint16_t len,
     uint8_t qos, uint8_t retain)
 {
+  if (queue(topic, false, false, data, false, len, qos, retain)) return;
   _elc->Request(CMD_MQTT_PUBLISH, 0, 5);
   _elc->Request(topic, strlen(topic));
   _elc->Request(data, len);
@@ -230,6 +836,7 @@ void ELClientMqtt::publish(const char* topic, const char* data, uint8_t qos, uin
 void ELClientMqtt::publish(const __FlashStringHelper* topic, const __FlashStringHelper* data,
     const uint16_t len, uint8_t qos, uint8_t retain)
 {
+  if (queue((const char*)topic, true, false, data, true, len, qos, retain)) return;
   _elc->Request(CMD_MQTT_PUBLISH, 0, 5);
   _elc->Request(topic, strlen_P((const char*)topic));
   _elc->Request(data, len);
@@ -261,6 +868,7 @@ void ELClientMqtt::publish(const __FlashStringHelper* topic, const __FlashString
 void ELClientMqtt::publish(const char* topic, const __FlashStringHelper* data,
     const uint16_t len, uint8_t qos, uint8_t retain)
 {
+  if (queue(topic, false, false, data, true, len, qos, retain)) return;
   _elc->Request(CMD_MQTT_PUBLISH, 0, 5);
   _elc->Request(topic, strlen(topic));
   _elc->Request(data, len);
@@ -292,6 +900,7 @@ void ELClientMqtt::publish(const char* topic, const __FlashStringHelper* data,
 void ELClientMqtt::publish(const __FlashStringHelper* topic, const uint8_t* data,
     const uint16_t len, uint8_t qos, uint8_t retain)
 {
+  if (queue((const char*)topic, true, false, data, false, len, qos, retain)) return;
   _elc->Request(CMD_MQTT_PUBLISH, 0, 5);
   _elc->Request(topic, strlen_P((const char*)topic));
   _elc->Request(data, len);
@@ -300,3 +909,85 @@ void ELClientMqtt::publish(const __FlashStringHelper* topic, const uint8_t* data
   _elc->Request(&retain, 1);
   _elc->Request();
 }
+
+/*! publish(const char* topic, ELClientProducer producer, void* ctx, uint16_t len, uint8_t qos, uint8_t retain)
+@brief Publish a message generated by a producer
+@details The producer is called repeatedly to print the payload straight into the outgoing frame,
+  so the payload never needs to be staged in RAM. If the payload length is not known up-front the
+  producer is run once more before sending to measure it and must then produce the same output
+  both times.
+@param topic
+  Topic name
+@param producer
+  Function that prints the payload, see ELClientProducer
+@param ctx
+  Context pointer passed to the producer
+@param len
+  (optional) Length of the payload, 0 to measure it with a dry-run of the producer
+@param qos
+  (optional) Requested qos level, default 0
+@param retain
+  (optional) Requested retain level, default 0
+@warning At the moment only qos level 0 is implemented and supported!
+@par Example
+@code
+  struct Reading { float temp; int16_t rssi; } reading;
+
+  boolean readingJson(Print* out, uint16_t chunk, void* ctx) {
+    Reading *r = (Reading*)ctx;
+    switch (chunk) {
+    case 0: out->print(F("{\"temp\":")); out->print(r->temp, 1); return true;
+    case 1: out->print(F(",\"rssi\":")); out->print(r->rssi); return true;
+    default: out->print('}'); return false;
+    }
+  }
+
+  mqtt.publish("/esp-link/telemetry", readingJson, &reading);
+@endcode
+*/
+void ELClientMqtt::publish(const char* topic, ELClientProducer producer, void* ctx,
+    uint16_t len, uint8_t qos, uint8_t retain)
+{
+  if (queue(topic, false, false, producer, ctx, len, qos, retain)) return;
+  _elc->Request(CMD_MQTT_PUBLISH, 0, 5);
+  _elc->Request(topic, strlen(topic));
+  len = _elc->Request(producer, ctx, len);
+  _elc->Request(&len, 2);
+  _elc->Request(&qos, 1);
+  _elc->Request(&retain, 1);
+  _elc->Request();
+}
+
+/*! publish(const __FlashStringHelper* topic, ELClientProducer producer, void* ctx, uint16_t len, uint8_t qos, uint8_t retain)
+@brief Publish a message generated by a producer
+@details Same as above with the topic stored in program memory
+@param topic
+  Topic name
+@param producer
+  Function that prints the payload, see ELClientProducer
+@param ctx
+  Context pointer passed to the producer
+@param len
+  (optional) Length of the payload, 0 to measure it with a dry-run of the producer
+@param qos
+  (optional) Requested qos level, default 0
+@param retain
+  (optional) Requested retain level, default 0
+@warning At the moment only qos level 0 is implemented and supported!
+@par Example
+@code
+  mqtt.publish(F("/esp-link/telemetry"), readingJson, &reading);
+@endcode
+*/
+void ELClientMqtt::publish(const __FlashStringHelper* topic, ELClientProducer producer, void* ctx,
+    uint16_t len, uint8_t qos, uint8_t retain)
+{
+  if (queue((const char*)topic, true, false, producer, ctx, len, qos, retain)) return;
+  _elc->Request(CMD_MQTT_PUBLISH, 0, 5);
+  _elc->Request(topic, strlen_P((const char*)topic));
+  len = _elc->Request(producer, ctx, len);
+  _elc->Request(&len, 2);
+  _elc->Request(&qos, 1);
+  _elc->Request(&retain, 1);
+  _elc->Request();
+}
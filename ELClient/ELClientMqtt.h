@@ -13,13 +13,35 @@
 #include "FP.h"
 #include "ELClient.h"
 
+class ELClientOutbox;
+
+// Descriptor for a received MQTT message or a fragment of one, passed to chunkCb and messageCb.
+// Messages that don't fit into the protocol buffer are split by esp-link into fragments, each
+// one carrying the offset of its data within the message and the total message length. The
+// topic is only sent with the first fragment (offset 0), later fragments have topicLen == 0.
+typedef struct {
+  const char* topic;     /**< Topic, not null-terminated for chunkCb, null-terminated for messageCb */
+  uint16_t topicLen;     /**< Length of the topic, 0 for continuation fragments */
+  const uint8_t* data;   /**< Message data, or fragment thereof */
+  uint16_t len;          /**< Number of bytes at data */
+  uint16_t offset;       /**< Offset of data within the whole message */
+  uint16_t total;        /**< Total length of the message */
+  boolean truncated;     /**< messageCb only: true if the message did not fit into the message buffer */
+} ELClientMqttChunk;
+
+// Tag to select the relative-topic overloads of publish and subscribe, which prepend the topic
+// prefix set with setPrefix, e.g. mqtt.publish(MQTT_RELATIVE, "temp", buf)
+typedef enum {
+  MQTT_RELATIVE = 1 /**< Topic is relative to the topic prefix */
+} MQTT_TOPIC;
+
 // Class to send and receive MQTT messages. This class should be used with a singleton object
 // because the esp-link implementation currently only supports a single MQTT server, so there is
 // no value in instantiating multiple ELClientMqtt objects (although it's possible).
 // All the server settings are made in esp-link and esp-link takes care to automatically
 // reconnect and retry if the connection is lost. This means that on the arduino side the only
 // code that is necessary is to send and receive messsages.
-class ELClientMqtt {
+class ELClientMqtt : public ELClientService {
   public:
     // Initialize with an ELClient object
     ELClientMqtt(ELClient* elc);
@@ -34,7 +56,19 @@ class ELClientMqtt {
     FP<void, void*> connectedCb;    /**< callback with no args when MQTT is connected */
     FP<void, void*> disconnectedCb; /**< callback with no args when MQTT is disconnected */
     FP<void, void*> publishedCb;    /**< not yet implemented */
-    FP<void, void*> dataCb;         /**< callback when a message is received, called with two arguments: the topic and the message (max ~110 bytes for both) */
+    FP<void, void*> dataCb;         /**< callback when a message is received, called with two arguments: the topic and the message (max ~110 bytes for both), not called for fragmented messages */
+    FP<void, void*> chunkCb;        /**< callback for each received message fragment, called with an ELClientMqttChunk */
+    FP<void, void*> messageCb;      /**< callback when a message has been reassembled in the message buffer, called with an ELClientMqttChunk */
+
+    // Provide a buffer to reassemble messages that are larger than the protocol buffer. The
+    // buffer holds the null-terminated topic followed by the message, anything that doesn't fit
+    // is dropped and flagged as truncated. Completed messages are passed to messageCb. Attaching
+    // chunkCb or setting a message buffer before calling setup tells esp-link to send large
+    // messages in fragments instead of truncating them (requires a fragment-capable esp-link).
+    void setMessageBuffer(uint8_t* buf, uint16_t size);
+
+    // returns true if esp-link reported that it is connected to the MQTT broker
+    boolean connected(void) { return _connected; }
 
     // subscribe to a topic, the default qos is 0. When messages are recevied for the topic the
     // data callback is invoked.
@@ -53,6 +87,51 @@ class ELClientMqtt {
     void publish(const __FlashStringHelper* topic, const uint8_t* data,
         const uint16_t len, uint8_t qos=0, uint8_t retain=0);
 
+    // publish a message whose payload is printed piecewise by a producer straight into the
+    // outgoing frame, if len is 0 the producer is run twice to measure the payload first
+    void publish(const char* topic, ELClientProducer producer, void* ctx,
+        uint16_t len=0, uint8_t qos=0, uint8_t retain=0);
+    void publish(const __FlashStringHelper* topic, ELClientProducer producer, void* ctx,
+        uint16_t len=0, uint8_t qos=0, uint8_t retain=0);
+
+    // set a device topic prefix, such as "/esp-link/1/", for the relative-topic overloads of
+    // publish and subscribe. The prefix is registered with esp-link, which stores it and
+    // prepends it to relative topics so the prefix doesn't travel in every frame. Until
+    // esp-link has confirmed the prefix (older versions never do) the prefix is prepended
+    // locally. The prefix string must remain valid, it is registered by setup, or right away
+    // if setup was already called.
+    void setPrefix(const char* prefix);
+    void setPrefix(const __FlashStringHelper* prefix);
+    // returns true if esp-link stores the prefix and relative topics are sent as-is
+    boolean prefixRegistered(void) { return _prefixRemote; }
+
+    // subscribe and publish to topics relative to the topic prefix
+    void subscribe(MQTT_TOPIC rel, const char* topic, uint8_t qos=0);
+    void subscribe(MQTT_TOPIC rel, const __FlashStringHelper* topic, uint8_t qos=0);
+    void publish(MQTT_TOPIC rel, const char* topic, const uint8_t* data,
+        const uint16_t len, uint8_t qos=0, uint8_t retain=0);
+    void publish(MQTT_TOPIC rel, const char* topic, const char* data,
+        uint8_t qos=0, uint8_t retain=0);
+    void publish(MQTT_TOPIC rel, const __FlashStringHelper* topic, const uint8_t* data,
+        const uint16_t len, uint8_t qos=0, uint8_t retain=0);
+    void publish(MQTT_TOPIC rel, const __FlashStringHelper* topic, const char* data,
+        uint8_t qos=0, uint8_t retain=0);
+    void publish(MQTT_TOPIC rel, const char* topic, ELClientProducer producer,
+        void* ctx, uint16_t len=0, uint8_t qos=0, uint8_t retain=0);
+    void publish(MQTT_TOPIC rel, const __FlashStringHelper* topic, ELClientProducer producer,
+        void* ctx, uint16_t len=0, uint8_t qos=0, uint8_t retain=0);
+
+    // Store messages in an outbox, e.g. in EEPROM, while MQTT is disconnected instead of passing
+    // them to esp-link, where they would be lost. After reconnecting the outbox is drained from
+    // ELClient::Process() at a rate of drainBurst messages every drainInterval milliseconds, new
+    // messages are queued behind the stored ones until it is empty, each of them sends two stored
+    // messages first so the backlog shrinks with every publish. The outbox must have been started
+    // with begin. Pass NULL to stop using the outbox.
+    void setOutbox(ELClientOutbox* outbox, uint16_t drainInterval=100, uint8_t drainBurst=1);
+
+    // Drain the outbox, called from ELClient::Process()
+    virtual void service(uint32_t now);
+
     // set a last-will topic & message
     void lwt(const char* topic, const char* message, uint8_t qos=0, uint8_t retain=0);
     void lwt(const __FlashStringHelper* topic, const __FlashStringHelper* message,
@@ -60,6 +139,43 @@ class ELClientMqtt {
 
   private:
     ELClient* _elc; /**< ELClient instance */
+    FP<void, void*> _connectedCb;    /**< Internal callback when MQTT is connected */
+    FP<void, void*> _disconnectedCb; /**< Internal callback when MQTT is disconnected */
+    FP<void, void*> _dataCb; /**< Internal callback for received messages and fragments */
+    void connectedCallback(void* resp);
+    void disconnectedCallback(void* resp);
+    void dataCallback(void* resp);
+    boolean _connected; /**< Connection status as last reported by esp-link */
+    void reassemble(ELClientMqttChunk* chunk);
+    void prefixCallback(void* resp);
+    void registerPrefix(void);
+    void requestTopic(uint16_t cmd, uint16_t argc, const char* topic, boolean flash);
+    static boolean printTopic(Print* out, uint16_t chunk, void* ctx);
+    boolean queue(const char* topic, boolean topicFlash, boolean relative, const void* data,
+        boolean dataFlash, uint16_t len, uint8_t qos, uint8_t retain);
+    boolean queue(const char* topic, boolean topicFlash, boolean relative, ELClientProducer producer,
+        void* ctx, uint16_t len, uint8_t qos, uint8_t retain);
+    boolean sendStored(void);
+
+    FP<void, void*> _prefixCb; /**< Internal callback confirming the topic prefix */
+    const char* _prefix;   /**< Topic prefix, NULL if none */
+    boolean _prefixFlash;  /**< Topic prefix is stored in program memory */
+    boolean _prefixRemote; /**< esp-link confirmed it stores the prefix */
+    boolean _setupDone;    /**< setup was called, so a new prefix is registered right away */
+
+    ELClientOutbox* _outbox;  /**< Outbox for messages published while disconnected, NULL if none */
+    uint16_t _drainInterval;  /**< Time between draining bursts in milliseconds */
+    uint8_t _drainBurst;      /**< Number of messages sent per draining burst */
+    uint32_t _drainAt;        /**< Time of the last draining burst */
+
+    uint8_t* _msgBuf;      /**< Message reassembly buffer, NULL if none */
+    uint16_t _msgSize;     /**< Size of the message reassembly buffer */
+    uint16_t _msgTopicLen; /**< Length of the topic stored at the start of the buffer */
+    uint16_t _msgLen;      /**< Number of message bytes stored after the topic */
+    uint16_t _msgTotal;    /**< Total length of the message being reassembled */
+    uint16_t _msgNext;     /**< Offset of the next expected fragment */
+    boolean _msgActive;    /**< A message is being reassembled */
+    boolean _msgTrunc;     /**< The message being reassembled did not fit */
 };
 
 #endif // _EL_CLIENT_MQTT_H_
@@ -0,0 +1,225 @@
+/*! \file ELClientOutbox.cpp
+    \brief Constructor and functions for ELClientOutbox
+*/
+#include "ELClientOutbox.h"
+
+// Slot header layout
+#define SLOT_SEQ       0    /**< Sequence number, 0 or 0xFF if the slot is unused */
+#define SLOT_FLAGS     1    /**< Entry flags */
+#define SLOT_TOPIC_LEN 2    /**< Length of the topic */
+#define SLOT_DATA_LEN  3    /**< Length of the data, 2 bytes */
+#define SLOT_HEADER    5    /**< Size of the header */
+#define SLOT_SENT      0x80 /**< Flag set when the message has been taken out of the outbox */
+
+// Print that writes to a range of storage, output beyond the range is dropped
+class StorageWriter : public Print {
+  public:
+    StorageWriter(ELClientStorage* storage, uint16_t addr, uint16_t limit) :
+      count(0), _storage(storage), _addr(addr), _limit(limit) {}
+    virtual size_t write(uint8_t c) {
+      if (count >= _limit) return 0;
+      _storage->write(_addr + count++, c);
+      return 1;
+    }
+    using Print::write;
+    uint16_t count;
+
+  private:
+    ELClientStorage* _storage;
+    uint16_t _addr;
+    uint16_t _limit;
+};
+
+/*! ELClientOutbox(ELClientStorage* storage, uint16_t slotSize)
+@brief Create an outbox
+@details The number of slots is the size of the storage divided by the slot size, at most 253.
+@param storage
+  Storage holding the outbox
+@param slotSize
+  (optional) Size of a slot in bytes, a message can hold up to slotSize-5 bytes of topic and data
+@par Example
+@code
+  ELClientEEPROMStorage storage(512, 512);
+  ELClientOutbox outbox(&storage, 64); // 8 messages of up to 59 bytes of topic and data
+@endcode
+*/
+ELClientOutbox::ELClientOutbox(ELClientStorage* storage, uint16_t slotSize) :
+  dropped(0), _storage(storage), _slotSize(slotSize), _slots(0), _tail(0), _count(0), _seq(1)
+{
+}
+
+/*! begin(void)
+@brief Recover the queued messages from storage
+@details Finds the most recently written slot by following the chain of consecutive sequence
+  numbers, the queued messages are the ones before it that haven't been sent yet.
+@par Example
+@code
+  outbox.begin();
+  Serial.print("Messages queued: ");
+  Serial.println(outbox.count());
+@endcode
+*/
+void ELClientOutbox::begin(void) {
+  _slots = _slotSize > SLOT_HEADER ? _storage->size() / _slotSize : 0;
+  if (_slots > 253) _slots = 253; // sequence numbers must not wrap around within the ring
+  _tail = 0;
+  _count = 0;
+  _seq = 1;
+
+  // the newest slot is a valid one whose successor doesn't continue the sequence
+  int16_t newest = -1;
+  for (uint16_t i=0; i<_slots; i++) {
+    uint8_t seq = _storage->read(slotAddr(i) + SLOT_SEQ);
+    if (!validSeq(seq)) continue;
+    uint8_t succ = _storage->read(slotAddr((i+1) % _slots) + SLOT_SEQ);
+    if (succ != nextSeq(seq)) {
+      newest = i;
+      _seq = nextSeq(seq);
+      break;
+    }
+  }
+  if (newest < 0) return;
+
+  // walk back over the unsent messages that precede it
+  _tail = (newest + 1) % _slots;
+  uint16_t slot = newest;
+  uint8_t seq = _storage->read(slotAddr(slot) + SLOT_SEQ);
+  while (_count < _slots) {
+    if (_storage->read(slotAddr(slot) + SLOT_FLAGS) & SLOT_SENT) break;
+    _count++;
+    _tail = slot;
+    slot = (slot + _slots - 1) % _slots;
+    uint8_t prev = _storage->read(slotAddr(slot) + SLOT_SEQ);
+    if (!validSeq(prev) || nextSeq(prev) != seq) break;
+    seq = prev;
+  }
+}
+
+/*! clear(void)
+@brief Drop all queued messages
+*/
+void ELClientOutbox::clear(void) {
+  while (_count > 0) pop();
+}
+
+/*! format(void)
+@brief Erase all slots
+@details Use this once on storage that previously held other data, which could otherwise be
+  mistaken for queued messages by begin.
+*/
+void ELClientOutbox::format(void) {
+  for (uint16_t i=0; i<_slots; i++)
+    _storage->write(slotAddr(i) + SLOT_SEQ, 0xFF);
+  _storage->commit();
+  _tail = 0;
+  _count = 0;
+  _seq = 1;
+}
+
+/*! push(uint8_t flags, ELClientProducer topic, void* topicCtx, uint16_t topicLen, ELClientProducer data, void* dataCtx, uint16_t dataLen)
+@brief Queue a message
+@details The topic and data are printed by producers straight into storage. The sequence number is
+  written last, so a message that is interrupted by a reset is not recovered. If the outbox is
+  full the oldest message is dropped.
+@param flags
+  qos level and OUTBOX_RETAIN
+@param topic
+  Producer printing the topic
+@param topicCtx
+  Context pointer passed to the topic producer
+@param topicLen
+  Length of the topic
+@param data
+  Producer printing the data
+@param dataCtx
+  Context pointer passed to the data producer
+@param dataLen
+  Length of the data
+@return <code>boolean</code>
+  True if the message has been queued, false if it doesn't fit into a slot
+*/
+boolean ELClientOutbox::push(uint8_t flags, ELClientProducer topic, void* topicCtx, uint16_t topicLen,
+    ELClientProducer data, void* dataCtx, uint16_t dataLen)
+{
+  if (_slots == 0 || topicLen > 255 || (uint32_t)topicLen + dataLen > maxMessage()) {
+    dropped++;
+    return false;
+  }
+  if (_count == _slots) {
+    pop();
+    dropped++;
+  }
+
+  uint16_t addr = slotAddr((_tail + _count) % _slots);
+  _storage->write(addr + SLOT_SEQ, 0);
+  StorageWriter t(_storage, addr + SLOT_HEADER, topicLen);
+  for (uint16_t chunk=0; topic(&t, chunk, topicCtx); chunk++)
+    ;
+  while (t.count < topicLen) t.write((uint8_t)0);
+  StorageWriter d(_storage, addr + SLOT_HEADER + topicLen, dataLen);
+  for (uint16_t chunk=0; data(&d, chunk, dataCtx); chunk++)
+    ;
+  while (d.count < dataLen) d.write((uint8_t)0);
+  _storage->write(addr + SLOT_FLAGS, flags & ~SLOT_SENT);
+  _storage->write(addr + SLOT_TOPIC_LEN, topicLen);
+  _storage->write(addr + SLOT_DATA_LEN, dataLen & 0xFF);
+  _storage->write(addr + SLOT_DATA_LEN + 1, dataLen >> 8);
+  _storage->write(addr + SLOT_SEQ, _seq);
+  _storage->commit();
+
+  _seq = nextSeq(_seq);
+  _count++;
+  return true;
+}
+
+/*! peek(ELClientOutboxEntry* entry)
+@brief Get the oldest message
+@param entry
+  Filled in with the flags and the storage ranges of the topic and data
+@return <code>boolean</code>
+  True if there is a message, false if the outbox is empty
+*/
+boolean ELClientOutbox::peek(ELClientOutboxEntry* entry) {
+  if (_count == 0) return false;
+  uint16_t addr = slotAddr(_tail);
+  entry->flags = _storage->read(addr + SLOT_FLAGS);
+  entry->topic.storage = _storage;
+  entry->topic.addr = addr + SLOT_HEADER;
+  entry->topic.len = _storage->read(addr + SLOT_TOPIC_LEN);
+  entry->data.storage = _storage;
+  entry->data.addr = entry->topic.addr + entry->topic.len;
+  entry->data.len = _storage->read(addr + SLOT_DATA_LEN) |
+      (uint16_t)_storage->read(addr + SLOT_DATA_LEN + 1) << 8;
+  return true;
+}
+
+/*! pop(void)
+@brief Remove the oldest message
+@details Marks the slot as sent, which is a single byte write
+*/
+void ELClientOutbox::pop(void) {
+  if (_count == 0) return;
+  uint16_t addr = slotAddr(_tail) + SLOT_FLAGS;
+  _storage->write(addr, _storage->read(addr) | SLOT_SENT);
+  _storage->commit();
+  _tail = (_tail + 1) % _slots;
+  _count--;
+}
+
+/*! printRange(Print* out, uint16_t chunk, void* ctx)
+@brief Producer that prints a range of storage
+@param out
+  Print to output to
+@param chunk
+  Chunk number, unused
+@param ctx
+  Pointer to an ELClientStorageRange
+@return <code>boolean</code>
+  False, the whole range is printed in one go
+*/
+boolean ELClientOutbox::printRange(Print* out, uint16_t, void* ctx) {
+  ELClientStorageRange* r = (ELClientStorageRange*)ctx;
+  for (uint16_t i=0; i<r->len; i++)
+    out->write(r->storage->read(r->addr + i));
+  return false;
+}
@@ -0,0 +1,84 @@
+/*! \file ELClientOutbox.h
+    \brief Definitions for ELClientOutbox
+*/
+// Persistent store-and-forward queue of MQTT messages
+
+#ifndef _EL_CLIENT_OUTBOX_H_
+#define _EL_CLIENT_OUTBOX_H_
+
+#include <Arduino.h>
+#include "ELClient.h"
+#include "ELClientStorage.h"
+
+#define OUTBOX_QOS_MASK  0x03 /**< Outbox entry flags: qos level */
+#define OUTBOX_RETAIN    0x04 /**< Outbox entry flags: retain */
+
+// A range of bytes in storage, printRange is a producer that prints it
+typedef struct {
+  ELClientStorage* storage; /**< Storage holding the bytes */
+  uint16_t addr;            /**< Address of the first byte */
+  uint16_t len;             /**< Number of bytes */
+} ELClientStorageRange;
+
+// An entry of the outbox, as returned by peek
+typedef struct {
+  uint8_t flags;              /**< qos level and retain flag */
+  ELClientStorageRange topic; /**< Topic of the message */
+  ELClientStorageRange data;  /**< Data of the message */
+} ELClientOutboxEntry;
+
+// ELClientOutbox is a persistent FIFO of messages in a ring of fixed-size slots in storage, such
+// as the EEPROM. Each slot holds a 5-byte header (sequence number, flags, topic and data length)
+// followed by the topic and the data, messages that don't fit into a slot are dropped. When the
+// outbox is full the oldest message is dropped to make room.
+// The queue's head and tail are not stored anywhere: they are recovered from the sequence numbers
+// of the slots by begin. Slots are written round-robin, so every slot gets the same number of
+// writes and no cell is rewritten for each message, which spreads the wear over the whole ring.
+class ELClientOutbox {
+  public:
+    // Create an outbox in storage with slots of slotSize bytes
+    ELClientOutbox(ELClientStorage* storage, uint16_t slotSize=64);
+
+    // Recover the messages queued in storage, must be called before use
+    void begin(void);
+    // Drop all queued messages
+    void clear(void);
+    // Erase all slots, for storage that previously held other data, call after begin
+    void format(void);
+
+    // Queue a message whose topic and data are printed by producers, returns false if it doesn't fit
+    boolean push(uint8_t flags, ELClientProducer topic, void* topicCtx, uint16_t topicLen,
+        ELClientProducer data, void* dataCtx, uint16_t dataLen);
+    // Get the oldest message, returns false if the outbox is empty
+    boolean peek(ELClientOutboxEntry* entry);
+    // Remove the oldest message
+    void pop(void);
+
+    // Number of queued messages
+    uint16_t count(void) { return _count; }
+    // Number of slots, i.e., the maximum number of queued messages
+    uint16_t slots(void) { return _slots; }
+    // Fill level in percent
+    uint8_t fill(void) { return _slots == 0 ? 100 : (uint32_t)_count * 100 / _slots; }
+    // Largest topic plus data length that fits into a slot
+    uint16_t maxMessage(void) { return _slotSize - 5; }
+
+    // Producer that prints an ELClientStorageRange
+    static boolean printRange(Print* out, uint16_t chunk, void* ctx);
+
+    uint32_t dropped; /**< Number of messages dropped because they were too large or the outbox was full */
+
+  private:
+    uint16_t slotAddr(uint16_t slot) { return slot * _slotSize; }
+    uint8_t nextSeq(uint8_t seq) { return seq >= 254 ? 1 : seq + 1; }
+    boolean validSeq(uint8_t seq) { return seq != 0 && seq != 0xFF; }
+
+    ELClientStorage* _storage; /**< Storage holding the slots */
+    uint16_t _slotSize; /**< Size of a slot in bytes */
+    uint16_t _slots;    /**< Number of slots */
+    uint16_t _tail;     /**< Slot of the oldest message */
+    uint16_t _count;    /**< Number of queued messages */
+    uint8_t _seq;       /**< Sequence number of the next message */
+};
+
+#endif // _EL_CLIENT_OUTBOX_H_
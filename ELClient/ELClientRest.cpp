@@ -8,12 +8,6 @@
 
 #include "ELClientRest.h"
 
-typedef enum {
-  HEADER_GENERIC = 0,    /**< Header is generic */
-  HEADER_CONTENT_TYPE,   /**< Header is content type */
-  HEADER_USER_AGENT      /**< Header is user agent */
-} HEADER_TYPE; /**< Enum of header types */
-
 /*! ELClientRest(ELClient *e)
 @brief Constructor for ELClientRest
 @param e
@@ -27,11 +21,45 @@ ELClientRest::ELClientRest(ELClient *e)
 {
   _elc = e;
   remote_instance = -1;
+  _streaming = false;
+  _respBuf = NULL;
+  _respSize = 0;
+  _respLen = 0;
+  _respTotal = 0;
+  _respTrunc = false;
+  _queue = NULL;
+  _qSize = 0;
+  _qHead = 0;
+  _qCount = 0;
+  _qBusy = false;
+  _qRetry = false;
+  _retryMax = 1;
+  _lat = NULL;
+  _latCount = 0;
+  _latPending = false;
+  _profile = NULL;
+  _profileCount = 0;
+  _profileFlash = false;
+  _headerSync = 0;
+  _headerSent = 0;
+  _headerFlash = 0;
+  _cache = NULL;
+  _cacheSize = 0;
+  _cachePending = false;
+  _cachePathLen = 0;
+  _cacheSlot = 0xFF;
+  cacheHits = 0;
+  cacheMisses = 0;
 }
 
 /*! restCallback(void *res)
 @brief Function called by esp-link when data is sent, received or an error occured.
 @details The function is called by esp-link when data is sent or received from the remote server.
+  Responses sent in fragments carry two extra arguments, the offset of the fragment within the
+  body and the total body length. All responses are passed on to chunkCb, if attached, and
+  copied into the response buffer, if set. A request completes with the first fragment if the
+  response isn't streamed, else with the fragment that ends the body, further fragments of the
+  response are dropped.
 @note Internal library function
 @param res
 	Pointer to ELClientResponse structure
@@ -43,13 +71,121 @@ void ELClientRest::restCallback(void *res)
 
   ELClientResponse *resp = (ELClientResponse *)res;
 
-  resp->popArg(&_status, sizeof(_status));
-  if (_elc->_debugEn) {
+  ELClientRestChunk chunk;
+  resp->popArg(&chunk.status, sizeof(chunk.status));
+  chunk.len = resp->popArgPtr((void**)&chunk.data);
+  chunk.offset = 0;
+  chunk.total = chunk.len;
+  boolean fragment = resp->argc() >= 4;
+  if (fragment) {
+    resp->popArg(&chunk.offset, 4);
+    resp->popArg(&chunk.total, 4);
+  }
+
+  // the rest of a response that already ended, either early after a lost fragment or because
+  // it isn't streamed, must not complete the request that was sent after it
+  if (fragment && chunk.offset != 0 && !_streaming) return;
+
+  if (_elc->_debugEn && chunk.offset == 0) {
     _elc->_debug->print("REST code ");
-    _elc->_debug->println(_status);
+    _elc->_debug->println(chunk.status);
   }
 
-  _len = resp->popArgPtr(&_data);
+  if (chunkCb.attached() || _respBuf != NULL) streamChunk(&chunk);
+  if (fragment) {
+    // the body went to chunkCb piece by piece, there is nothing left for getResponse
+    if (_streaming) return;
+    chunk.len = 0;
+  }
+  _data = (void*)chunk.data;
+  _len = chunk.len;
+  _status = chunk.status;
+  recordLatency(false);
+  if (_cachePending) cacheStore(fragment);
+  if (_qBusy) complete(chunk.status);
+}
+
+/*! streamChunk(ELClientRestChunk* chunk)
+@brief Pass a response or response fragment to chunkCb and the response buffer
+@details A fragment with offset 0 starts a new response and produces REST_STATUS, every fragment
+  produces REST_BODY and the one that completes the body produces REST_DONE. A fragment that
+  doesn't continue the current response means a fragment got lost and the response ends early.
+@note Internal library function
+@param chunk
+	Response or response fragment, the event and offset are updated
+*/
+void ELClientRest::streamChunk(ELClientRestChunk* chunk)
+{
+  if (chunk->offset == 0) {
+    _streaming = true;
+    _next = 0;
+    ELClientRestChunk status = *chunk;
+    status.event = REST_STATUS;
+    status.data = NULL;
+    status.len = 0;
+    bufferChunk(&status);
+    if (chunkCb.attached()) chunkCb(&status);
+  }
+  if (!_streaming) return;
+
+  if (chunk->offset != _next) {
+    chunk->event = REST_DONE;
+    chunk->offset = _next;
+    chunk->len = 0;
+    _streaming = false;
+    bufferChunk(chunk);
+    if (chunkCb.attached()) chunkCb(chunk);
+    return;
+  }
+
+  if (chunk->len > 0) {
+    chunk->event = REST_BODY;
+    bufferChunk(chunk);
+    if (chunkCb.attached()) chunkCb(chunk);
+  }
+  _next += chunk->len;
+  if (_next >= chunk->total) {
+    chunk->event = REST_DONE;
+    chunk->offset = _next;
+    chunk->len = 0;
+    _streaming = false;
+    bufferChunk(chunk);
+    if (chunkCb.attached()) chunkCb(chunk);
+  }
+}
+
+/*! bufferChunk(ELClientRestChunk* chunk)
+@brief Copy a response event into the response buffer
+@note Internal library function
+@param chunk
+	Response event
+*/
+void ELClientRest::bufferChunk(ELClientRestChunk* chunk)
+{
+  if (_respBuf == NULL) return;
+  switch (chunk->event) {
+  case REST_STATUS:
+    _respLen = 0;
+    _respTrunc = false;
+    _respBuf[0] = 0;
+    break;
+  case REST_BODY: {
+    uint16_t room = _respSize - 1 - _respLen;
+    uint16_t len = chunk->len;
+    if (len > room) {
+      len = room;
+      _respTrunc = true;
+    }
+    memcpy(_respBuf + _respLen, chunk->data, len);
+    _respLen += len;
+    _respBuf[_respLen] = 0;
+    break;
+  }
+  case REST_DONE:
+    _respTotal = chunk->total;
+    if (chunk->offset < chunk->total) _respTrunc = true;
+    break;
+  }
 }
 
 /*! begin(const char* host, uint16_t port, boolean security)
@@ -62,6 +198,12 @@ void ELClientRest::restCallback(void *res)
 	Port to be used to send/receive packets. Port MUST NOT be 80, 23 or 2323, as these ports are already used by EL-CLIENT on the ESP8266
 @param security
 	Flag if secure connection should be established
+@param respBuf
+	(optional) Response buffer, see setResponseBuffer
+@param respSize
+	(optional) Size of the response buffer
+@note If chunkCb is attached or a response buffer is set, the size of the protocol buffer is sent
+	along so esp-link streams responses that don't fit in fragments.
 @warning Port MUST NOT be 80, 23 or 2323, as these ports are already used by EL-CLIENT on the ESP8266.
 	Max 4 connections are supported!
 @par Example
@@ -75,25 +217,64 @@ void ELClientRest::restCallback(void *res)
 	}
 @endcode
 */
-int ELClientRest::begin(const char* host, uint16_t port, boolean security)
+int ELClientRest::begin(const char* host, uint16_t port, boolean security,
+    char* respBuf, uint16_t respSize)
 {
+  if (respBuf != NULL) setResponseBuffer(respBuf, respSize);
   uint8_t sec = !!security;
+  boolean stream = chunkCb.attached() || _respBuf != NULL;
   restCb.attach(this, &ELClientRest::restCallback);
 
-  _elc->Request(CMD_REST_SETUP, (uint32_t)&restCb, 3);
+  _elc->Request(CMD_REST_SETUP, (uint32_t)&restCb, stream ? 4 : 3);
   _elc->Request(host, strlen(host));
   _elc->Request(&port, 2);
   _elc->Request(&sec, 1);
+  if (stream) _elc->Request(&_elc->_proto.bufSize, 2);
   _elc->Request();
 
   ELClientPacket *pkt = _elc->WaitReturn();
   if (pkt && (int32_t)pkt->value >= 0) {
     remote_instance = pkt->value;
+    _headerSent = 0;
+    registerHeaders();
     return 0;
   }
   return (int)pkt->value;
 }
 
+/*! setResponseBuffer(char* buf, uint16_t size)
+@brief Set a buffer that response bodies are copied into when they arrive
+@details Without a response buffer only a pointer into the protocol buffer is kept, so the body
+	is lost as soon as the next message is processed. With a response buffer the body is copied
+	when it arrives and remains available until the next response of this instance, so several
+	instances can have responses outstanding at the same time. Bodies are null-terminated, a body
+	that doesn't fit is truncated to size-1 bytes and truncated() returns true.
+@param buf
+	Response buffer, NULL to remove it
+@param size
+	Size of the response buffer, at least 1
+@warning Must be called before begin
+@par Example
+@code
+	char response[200];
+	rest.setResponseBuffer(response, sizeof(response));
+	rest.begin("www.timeapi.org");
+	...
+	if (rest.getResponse(NULL, 0) == HTTP_STATUS_OK) {
+		Serial.println(rest.response());
+		if (rest.truncated()) Serial.println("(truncated)");
+	}
+@endcode
+*/
+void ELClientRest::setResponseBuffer(char* buf, uint16_t size)
+{
+  _respBuf = size > 0 ? buf : NULL;
+  _respSize = size;
+  _respLen = 0;
+  _respTrunc = false;
+  if (_respBuf != NULL) _respBuf[0] = 0;
+}
+
 /*! request(const char* path, const char* method, const char* data, int len)
 @brief Send request to REST server.
 @param path
@@ -112,7 +293,10 @@ int ELClientRest::begin(const char* host, uint16_t port, boolean security)
 void ELClientRest::request(const char* path, const char* method, const char* data, int len)
 {
   _status = 0;
+  _cachePending = false;
   if (remote_instance < 0) return;
+  if (_headerSync != _elc->_syncCount) registerHeaders();
+  startLatency(path);
   if (data != 0 && len > 0) _elc->Request(CMD_REST_REQUEST, remote_instance, 3);
   else                      _elc->Request(CMD_REST_REQUEST, remote_instance, 2);
   _elc->Request(method, strlen(method));
@@ -124,6 +308,49 @@ void ELClientRest::request(const char* path, const char* method, const char* dat
   _elc->Request();
 }
 
+/*! request(ELClientProducer path, void* ctx, const char* method, const char* data)
+@brief Send request to REST server with a path printed by a producer
+@details The producer is run twice, first to measure the length of the path and then to send it,
+	so it must print the same both times. Usually it uses an ELClientRestPath to append URL-encoded
+	segments and query parameters, which avoids building the path in a buffer.
+@param path
+	Producer that prints the path
+@param ctx
+	Passed to the producer
+@param method
+	REST method, allowed values are "GET", "POST", "PUT" or "DELETE"
+@param data
+	(optional) Pointer to null-terminated data
+@par Example
+@code
+	float solarValue;
+
+	boolean updatePath(Print* out, uint16_t chunk, void* ctx) {
+		ELClientRestPath path(out);
+		path.raw(F("/update"));
+		path.param(F("api_key"), api_key);
+		path.param(F("field1"), solarValue, 2);
+		return false;
+	}
+
+	rest.request(updatePath, NULL, "POST");
+@endcode
+*/
+void ELClientRest::request(ELClientProducer path, void* ctx, const char* method, const char* data)
+{
+  _status = 0;
+  _cachePending = false;
+  if (remote_instance < 0) return;
+  if (_headerSync != _elc->_syncCount) registerHeaders();
+  uint16_t len = data != NULL ? strlen(data) : 0;
+  startLatency(NULL);
+  _elc->Request(CMD_REST_REQUEST, remote_instance, len > 0 ? 3 : 2);
+  _elc->Request(method, strlen(method));
+  _elc->Request(path, ctx);
+  if (len > 0) _elc->Request(data, len);
+  _elc->Request();
+}
+
 /*! request(const char* path, const char* method, const char* data)
 @brief Send request to REST server.
 @details The data must be null-terminated.
@@ -140,7 +367,638 @@ void ELClientRest::request(const char* path, const char* method, const char* dat
 */
 void ELClientRest::request(const char* path, const char* method, const char* data)
 {
-  request(path, method, data, strlen(data));
+  request(path, method, data, data != NULL ? strlen(data) : 0);
+}
+
+/*! setQueue(ELClientRestRequest* slots, uint8_t size, uint32_t timeout)
+@brief Set up a request queue
+@details Requests added with enqueue are sent one at a time: the next one is sent when the
+	response to the previous one has arrived or when it timed out. Each request's doneCb is called
+	with the status and timing filled in. This allows an application to queue a burst of requests
+	and return to its loop.
+@param slots
+	Array of queue entries
+@param size
+	Number of queue entries
+@param timeout
+	(optional) Time in milliseconds to wait for each response, defaults to 5000ms
+@warning A response that arrives after its request timed out is taken to be the response to the
+	next request, so the timeout must be longer than the time the server takes to respond.
+@par Example
+@code
+	ELClientRestRequest queue[4];
+
+	void readingDone(void* r) {
+		ELClientRestRequest* req = (ELClientRestRequest*)r;
+		Serial.print(req->status);
+		Serial.print(" in ");
+		Serial.print(req->doneAt - req->sentAt);
+		Serial.println("ms");
+	}
+
+	void setup() {
+		...
+		rest.setQueue(queue, 4);
+	}
+
+	void loop() {
+		esp.Process();
+		if (timeToReport) {
+			rest.enqueue("/update?field1=1", "POST")->doneCb.attach(readingDone);
+			rest.enqueue("/update?field2=2", "POST")->doneCb.attach(readingDone);
+		}
+	}
+@endcode
+*/
+void ELClientRest::setQueue(ELClientRestRequest* slots, uint8_t size, uint32_t timeout)
+{
+  _queue = size > 0 ? slots : NULL;
+  _qSize = size;
+  _qHead = 0;
+  _qCount = 0;
+  _qBusy = false;
+  _qRetry = false;
+  _qTimeout = timeout;
+  _cacheSlot = 0xFF;
+  if (_queue != NULL) _elc->attachService(this);
+  else                _elc->detachService(this);
+}
+
+/*! enqueue(const char* path, const char* method, const char* data)
+@brief Queue a request
+@details The data must be null-terminated. The path, method and data are not copied.
+@param path
+	Path that extends the URL of the REST request (command or data for the REST server)
+@param method
+	REST method, allowed values are "GET", "POST", "PUT" or "DELETE"
+@param data
+	(optional) Pointer to data buffer
+@return <code>ELClientRestRequest*</code>
+	Queue entry of the request, NULL if the queue is full
+*/
+ELClientRestRequest* ELClientRest::enqueue(const char* path, const char* method, const char* data)
+{
+  return enqueue(path, method, data, data != NULL ? strlen(data) : 0);
+}
+
+/*! enqueue(const char* path, const char* method, const char* data, uint16_t len)
+@brief Queue a request
+@details The path, method and data are not copied. The request is sent right away if the queue
+	was empty, else when the requests before it have completed. The doneCb of the returned entry
+	is detached, it can be attached before the next call to ELClient::Process.
+@param path
+	Path that extends the URL of the REST request (command or data for the REST server)
+@param method
+	REST method, allowed values are "GET", "POST", "PUT" or "DELETE"
+@param data
+	Pointer to data buffer
+@param len
+	Size of data buffer
+@return <code>ELClientRestRequest*</code>
+	Queue entry of the request, NULL if the queue is full
+*/
+ELClientRestRequest* ELClientRest::enqueue(const char* path, const char* method, const char* data,
+    uint16_t len)
+{
+  if (_queue == NULL || _qCount == _qSize) return NULL;
+  ELClientRestRequest* req = &_queue[(_qHead + _qCount) % _qSize];
+  req->path = path;
+  req->method = method;
+  req->data = data;
+  req->len = len;
+  req->doneCb.detach();
+  req->ctx = NULL;
+  req->status = 0;
+  req->attempts = 0;
+  req->queuedAt = millis();
+  req->sentAt = 0;
+  req->doneAt = 0;
+  _qCount++;
+  if (!_qBusy && !_qRetry) dispatch();
+  return req;
+}
+
+/*! dispatch(void)
+@brief Send the oldest queued request
+@note Internal library function
+*/
+void ELClientRest::dispatch(void)
+{
+  if (_qCount == 0) return;
+  ELClientRestRequest* req = &_queue[_qHead];
+  req->sentAt = millis();
+  req->attempts++;
+  _qBusy = true;
+  request(req->path, req->method, req->data, req->len);
+  _cachePending = _qHead == _cacheSlot;
+}
+
+/*! complete(int16_t status)
+@brief Complete the request in flight and send the next one
+@details If the request is to be retried it stays at the head of the queue. Otherwise doneCb is
+	called before the entry is removed and the next request is sent, so the response body is
+	still available to it and it may queue further requests.
+@note Internal library function
+@param status
+	HTTP status code, 0 for a timeout
+*/
+void ELClientRest::complete(int16_t status)
+{
+  ELClientRestRequest* req = &_queue[_qHead];
+  req->status = status;
+  req->doneAt = millis();
+  // after a timeout the late response must not be cached
+  _cachePending = false;
+  if (retry(req)) return;
+  if (_qHead == _cacheSlot) _cacheSlot = 0xFF;
+  if (req->doneCb.attached()) req->doneCb(req);
+  _qHead = (_qHead + 1) % _qSize;
+  _qCount--;
+  _qBusy = false;
+  dispatch();
+}
+
+/*! setRetry(uint8_t maxAttempts, uint16_t baseDelay, uint16_t maxDelay, uint8_t jitter, uint8_t retryOn)
+@brief Set the retry policy for queued requests
+@details Failed requests are retried from ELClient::Process() without blocking, the request stays
+	at the head of the queue until it succeeds or runs out of attempts, and only then doneCb is
+	called. The delay before attempt n+1 is baseDelay * 2^(n-1), at most maxDelay, minus a random
+	amount of up to jitter percent of it.
+@param maxAttempts
+	Maximum number of times a request is sent, 1 to not retry
+@param baseDelay
+	(optional) Delay before the first retry in milliseconds, defaults to 1000ms
+@param maxDelay
+	(optional) Maximum delay between retries in milliseconds, defaults to 30000ms
+@param jitter
+	(optional) Percentage of each delay that is randomized, defaults to 50
+@param retryOn
+	(optional) Failures to retry, REST_RETRY_TIMEOUT and/or REST_RETRY_5XX, defaults to both
+@par Example
+@code
+	void uploadDone(void* r) {
+		ELClientRestRequest* req = (ELClientRestRequest*)r;
+		if (req->status != HTTP_STATUS_OK) {
+			Serial.print("upload failed after ");
+			Serial.print(req->attempts);
+			Serial.println(" attempts");
+		}
+	}
+
+	rest.setQueue(queue, 4);
+	rest.setRetry(5, 2000, 60000); // retry after about 2s, 4s, 8s and 16s
+	rest.enqueue("/update?field1=1", "POST")->doneCb.attach(uploadDone);
+@endcode
+*/
+void ELClientRest::setRetry(uint8_t maxAttempts, uint16_t baseDelay, uint16_t maxDelay,
+    uint8_t jitter, uint8_t retryOn)
+{
+  _retryMax = maxAttempts > 0 ? maxAttempts : 1;
+  _retryBase = baseDelay;
+  _retryMaxDelay = maxDelay;
+  _retryJitter = jitter > 100 ? 100 : jitter;
+  _retryOn = retryOn;
+}
+
+/*! retry(ELClientRestRequest* req)
+@brief Schedule a retry of a failed request
+@note Internal library function
+@param req
+	Request at the head of the queue that just completed
+@return <code>boolean</code>
+	True if the request will be retried
+*/
+boolean ELClientRest::retry(ELClientRestRequest* req)
+{
+  if (req->attempts >= _retryMax) return false;
+  boolean timeout = req->status == 0 && (_retryOn & REST_RETRY_TIMEOUT);
+  boolean server = req->status >= 500 && req->status <= 599 && (_retryOn & REST_RETRY_5XX);
+  if (!timeout && !server) return false;
+
+  uint32_t delay = _retryBase;
+  for (uint8_t i=1; i<req->attempts && delay < _retryMaxDelay; i++) delay <<= 1;
+  if (delay > _retryMaxDelay) delay = _retryMaxDelay;
+  delay -= random(delay * _retryJitter / 100 + 1);
+
+  _retryAt = millis() + delay;
+  _qBusy = false;
+  _qRetry = true;
+  return true;
+}
+
+/*! service(uint32_t now)
+@brief Time out the request in flight and send retries that are due
+@details A request sent by another service in the same pass is stamped after now, so the time is
+	compared signed to not see it as sent 49 days ago.
+@note Internal library function, called from ELClient::Process()
+@param now
+	Current time in milliseconds
+*/
+void ELClientRest::service(uint32_t now)
+{
+  if (_qBusy && (int32_t)(now - _queue[_qHead].sentAt) >= (int32_t)_qTimeout) {
+    _streaming = false;
+    recordLatency(true);
+    complete(0);
+  }
+  if (_qRetry && (int32_t)(now - _retryAt) >= 0) {
+    _qRetry = false;
+    dispatch();
+  }
+}
+
+/*! setLatencyStats(ELClientRestLatency* stats, uint8_t count)
+@brief Measure the latency of requests
+@details The latency is the time from sending a request to esp-link until the complete response
+	has arrived, so it includes encoding, the UART in both directions, esp-link and the server.
+	Requests that time out in the request queue or in waitResponse are counted as timeouts.
+	stats[0] gets all requests, each further entry gets the requests of one path, where the query
+	string is not part of the path, e.g. "/update?field1=3" counts as "/update". Paths printed by
+	a producer only count in stats[0].
+@param stats
+	Array of latency histograms, NULL to stop measuring
+@param count
+	Number of entries, 1 to only measure per instance
+@par Example
+@code
+	ELClientRestLatency latency[3]; // all requests and two endpoints
+
+	rest.setLatencyStats(latency, 3);
+	...
+	// use the time 99% of the requests completed in as timeout
+	rest.setQueue(queue, 4, rest.latencyPercentile(0, 99));
+	// publish the stats
+	mqtt.publish("/stats/rest", &ELClientRest::printLatency, &rest);
+@endcode
+*/
+void ELClientRest::setLatencyStats(ELClientRestLatency* stats, uint8_t count)
+{
+  _lat = count > 0 ? stats : NULL;
+  _latCount = count;
+  _latPending = false;
+  resetLatencyStats();
+}
+
+/*! resetLatencyStats(void)
+@brief Clear the latency stats
+*/
+void ELClientRest::resetLatencyStats(void)
+{
+  if (_lat != NULL) memset(_lat, 0, _latCount * sizeof(ELClientRestLatency));
+}
+
+/*! latencyPercentile(uint8_t entry, uint8_t pct)
+@brief Latency that a percentage of the responses stayed below
+@param entry
+	Index of the latency stats entry
+@param pct
+	Percentage, 1 to 100
+@return <code>uint32_t</code>
+	Upper bound of the bucket the percentile falls into in milliseconds, 0 if there are no
+	responses, 0xFFFFFFFF if it falls into the last bucket
+*/
+uint32_t ELClientRest::latencyPercentile(uint8_t entry, uint8_t pct)
+{
+  if (_lat == NULL || entry >= _latCount) return 0;
+  ELClientRestLatency* stats = &_lat[entry];
+  uint32_t total = 0;
+  for (uint8_t i=0; i<REST_LATENCY_BUCKETS; i++) total += stats->buckets[i];
+  if (total == 0) return 0;
+  uint32_t want = (total * pct + 99) / 100, seen = 0;
+  for (uint8_t i=0; i<REST_LATENCY_BUCKETS-1; i++) {
+    seen += stats->buckets[i];
+    if (seen >= want) return 16UL << i;
+  }
+  return 0xFFFFFFFFUL;
+}
+
+/*! printLatency(Print* out, uint16_t chunk, void* ctx)
+@brief Producer that prints latency stats as JSON
+@details Prints an array with one object per entry in use, e.g.
+	[{"path":0,"timeouts":1,"mean":180,"max":950,"buckets":[0,0,0,2,5,1,0,0,0,0,0,0]}]
+@param out
+	Print to output to
+@param chunk
+	Chunk number, unused
+@param ctx
+	Pointer to the ELClientRest
+@return <code>boolean</code>
+	False, all stats are printed in one go
+*/
+boolean ELClientRest::printLatency(Print* out, uint16_t, void* ctx)
+{
+  ELClientRest* rest = (ELClientRest*)ctx;
+  out->write('[');
+  for (uint8_t e=0; e<rest->_latCount; e++) {
+    ELClientRestLatency* stats = &rest->_lat[e];
+    if (e > 0 && stats->path == 0) break;
+    uint32_t n = 0;
+    for (uint8_t i=0; i<REST_LATENCY_BUCKETS; i++) n += stats->buckets[i];
+    if (e > 0) out->write(',');
+    out->print(F("{\"path\":"));
+    out->print(stats->path);
+    out->print(F(",\"timeouts\":"));
+    out->print(stats->timeouts);
+    out->print(F(",\"mean\":"));
+    out->print(n > 0 ? stats->sum / n : 0);
+    out->print(F(",\"max\":"));
+    out->print(stats->max);
+    out->print(F(",\"buckets\":["));
+    for (uint8_t i=0; i<REST_LATENCY_BUCKETS; i++) {
+      if (i > 0) out->write(',');
+      out->print(stats->buckets[i]);
+    }
+    out->print(F("]}"));
+  }
+  out->write(']');
+  return false;
+}
+
+/*! startLatency(const char* path)
+@brief Start timing a request
+@note Internal library function
+@param path
+	Path of the request, NULL if not known
+*/
+void ELClientRest::startLatency(const char* path)
+{
+  if (_lat == NULL) return;
+  _latPending = true;
+  _latSent = millis();
+  _latPath = 0;
+  if (path == NULL) return;
+  uint16_t hash = 5381;
+  for (; *path != 0 && *path != '?'; path++)
+    hash = ((hash << 5) + hash) ^ (uint8_t)*path;
+  _latPath = hash != 0 ? hash : 1;
+}
+
+/*! recordLatency(boolean timeout)
+@brief Record the latency or the timeout of the request being timed
+@note Internal library function
+@param timeout
+	The request timed out
+*/
+void ELClientRest::recordLatency(boolean timeout)
+{
+  if (_lat == NULL || !_latPending) return;
+  _latPending = false;
+  uint32_t ms = millis() - _latSent;
+  addLatency(&_lat[0], ms, timeout);
+  if (_latPath == 0) return;
+  for (uint8_t i=1; i<_latCount; i++) {
+    if (_lat[i].path == 0) _lat[i].path = _latPath;
+    if (_lat[i].path == _latPath) {
+      addLatency(&_lat[i], ms, timeout);
+      return;
+    }
+  }
+}
+
+/*! addLatency(ELClientRestLatency* stats, uint32_t ms, boolean timeout)
+@brief Add a latency or a timeout to a histogram
+@note Internal library function
+*/
+void ELClientRest::addLatency(ELClientRestLatency* stats, uint32_t ms, boolean timeout)
+{
+  if (timeout) {
+    if (stats->timeouts < 0xFFFF) stats->timeouts++;
+    return;
+  }
+  uint8_t b = 0;
+  while (b < REST_LATENCY_BUCKETS-1 && ms >= (16UL << b)) b++;
+  if (stats->buckets[b] < 0xFFFF) stats->buckets[b]++;
+  stats->sum += ms;
+  if (ms > stats->max) stats->max = ms > 0xFFFF ? 0xFFFF : ms;
+}
+
+// header of a cached response, followed by the path and the body
+typedef struct {
+  uint16_t key;      // hash of the method and path, to skip most entries without comparing paths
+  int16_t status;    // HTTP status code
+  uint16_t pathLen;  // length of the path
+  uint16_t len;      // length of the body
+  uint32_t expires;  // millis() when the response expires
+} CacheEntry;
+
+/*! setCache(uint8_t* buf, uint16_t size)
+@brief Set up a response cache for cachedGet
+@details The cache holds as many responses as fit into the buffer, each taking its path and body
+	length plus a small header. When a new response doesn't fit, expired and then the oldest responses are
+	dropped. Only 2xx responses are cached, responses that were truncated in the response buffer
+	or streamed without one are not.
+@param buf
+	Cache buffer, NULL to stop caching
+@param size
+	Size of the cache buffer
+@par Example
+@code
+	uint8_t cache[256];
+
+	rest.setCache(cache, sizeof(cache));
+	...
+	// however often this is called, it causes at most one request per minute
+	if (rest.cachedGet("/config", 60000)) useConfig(rest.response());
+@endcode
+*/
+void ELClientRest::setCache(uint8_t* buf, uint16_t size)
+{
+  _cache = size > 0 ? buf : NULL;
+  _cacheSize = size;
+  clearCache();
+}
+
+/*! clearCache(void)
+@brief Drop all cached responses
+*/
+void ELClientRest::clearCache(void)
+{
+  _cacheUsed = 0;
+  _cachePending = false;
+  _cacheSlot = 0xFF;
+}
+
+/*! invalidate(const char* path)
+@brief Drop the cached response for a path
+@param path
+	Path as passed to cachedGet
+*/
+void ELClientRest::invalidate(const char* path)
+{
+  if (_cache == NULL) return;
+  int16_t offset = cacheFind(cacheKey("GET", path), path, strlen(path));
+  if (offset >= 0) cacheRemove(offset);
+}
+
+/*! cachedGet(const char* path, uint32_t ttl)
+@brief Send a GET request unless a fresh response is cached
+@details On a hit the cached response is delivered right away without involving esp-link: the
+	status and body are available to getResponse and response, and chunkCb is called. On a miss
+	the request is sent and its response is cached with the given time to live when it arrives.
+	While a streamed response is arriving the cache is bypassed and the request is sent, so the
+	response in progress isn't cut short by the cached one. If a queue is set up the request is
+	queued as with enqueue, so the response isn't mixed up with the one of a queued request and
+	the path must stay valid until it completes. Only the response of one queued cachedGet at a
+	time is cached, further misses are queued without caching theirs. With a full queue the
+	request is dropped as by enqueue.
+@param path
+	Path that extends the URL of the REST request
+@param ttl
+	Time in milliseconds a response may be served from the cache
+@return <code>boolean</code>
+	True if the response was served from the cache
+@warning Without a response buffer the body returned by getResponse on a hit points into the
+	cache and is only valid until the next response is cached.
+*/
+boolean ELClientRest::cachedGet(const char* path, uint32_t ttl)
+{
+  uint16_t key = cacheKey("GET", path);
+  int16_t offset = _cache != NULL && !_streaming ? cacheFind(key, path, strlen(path)) : -1;
+  if (offset < 0) {
+    cacheMisses++;
+    // the path is reserved for the response unless a queued one already waits to be cached
+    boolean cache = _cache != NULL && (_queue == NULL || _cacheSlot == 0xFF) &&
+        (_queue == NULL || _qCount < _qSize) && cacheReserve(path);
+    if (cache) {
+      _cacheKey = key;
+      _cacheTtl = ttl;
+    }
+    if (_queue == NULL) {
+      get(path);
+      _cachePending = cache;
+    } else {
+      // dispatch marks the response to be cached when the request is sent
+      if (cache) _cacheSlot = (_qHead + _qCount) % _qSize;
+      enqueue(path, "GET");
+    }
+    return false;
+  }
+
+  cacheHits++;
+  CacheEntry e;
+  memcpy(&e, _cache + offset, sizeof(e));
+  ELClientRestChunk chunk;
+  chunk.status = e.status;
+  chunk.data = _cache + offset + sizeof(e) + e.pathLen;
+  chunk.len = e.len;
+  chunk.offset = 0;
+  chunk.total = e.len;
+  if (chunkCb.attached() || _respBuf != NULL) streamChunk(&chunk);
+  _data = (void*)(_cache + offset + sizeof(e) + e.pathLen);
+  _len = e.len;
+  _status = e.status;
+  return true;
+}
+
+/*! cacheKey(const char* method, const char* path)
+@brief Hash of a method and path
+@note Internal library function
+*/
+uint16_t ELClientRest::cacheKey(const char* method, const char* path)
+{
+  uint16_t hash = 5381;
+  while (*method != 0) hash = ((hash << 5) + hash) ^ (uint8_t)*method++;
+  hash = ((hash << 5) + hash) ^ ' ';
+  while (*path != 0) hash = ((hash << 5) + hash) ^ (uint8_t)*path++;
+  return hash;
+}
+
+/*! cacheFind(uint16_t key, const char* path, uint16_t pathLen)
+@brief Find an unexpired cached response, dropping expired ones
+@note Internal library function
+@return <code>int16_t</code>
+	Offset of the response in the cache, -1 if none
+*/
+int16_t ELClientRest::cacheFind(uint16_t key, const char* path, uint16_t pathLen)
+{
+  uint32_t now = millis();
+  uint16_t offset = 0;
+  while (offset < _cacheUsed) {
+    CacheEntry e;
+    memcpy(&e, _cache + offset, sizeof(e));
+    if ((int32_t)(now - e.expires) >= 0) {
+      cacheRemove(offset);
+      continue;
+    }
+    if (e.key == key && e.pathLen == pathLen &&
+        memcmp(_cache + offset + sizeof(e), path, pathLen) == 0) return offset;
+    offset += sizeof(e) + e.pathLen + e.len;
+  }
+  return -1;
+}
+
+/*! cacheReserve(const char* path)
+@brief Keep the path of a request whose response is to be cached
+@details The path is copied to the end of the cache buffer, beyond the cached responses, so it
+	needn't stay valid until the response arrives. Old responses are dropped to make room.
+@note Internal library function
+@return <code>boolean</code>
+	False if the path doesn't fit into the cache
+*/
+boolean ELClientRest::cacheReserve(const char* path)
+{
+  uint16_t n = strlen(path);
+  if (sizeof(CacheEntry) + n > _cacheSize) return false;
+  while (_cacheUsed + n > _cacheSize) cacheRemove(0);
+  memcpy(_cache + _cacheSize - n, path, n);
+  _cachePathLen = n;
+  return true;
+}
+
+/*! cacheRemove(uint16_t offset)
+@brief Drop a cached response
+@note Internal library function
+*/
+void ELClientRest::cacheRemove(uint16_t offset)
+{
+  CacheEntry e;
+  memcpy(&e, _cache + offset, sizeof(e));
+  uint16_t size = sizeof(e) + e.pathLen + e.len;
+  memmove(_cache + offset, _cache + offset + size, _cacheUsed - offset - size);
+  _cacheUsed -= size;
+}
+
+/*! cacheStore(boolean streamed)
+@brief Cache the response that just arrived
+@details Drops expired responses and the previous response for the same path, then the oldest
+	responses until the new one fits.
+@note Internal library function
+@param streamed
+	The response arrived in fragments
+*/
+void ELClientRest::cacheStore(boolean streamed)
+{
+  _cachePending = false;
+  if (_status < 200 || _status > 299) return;
+  const uint8_t* body = (const uint8_t*)_data;
+  uint16_t len = _len;
+  if (_respBuf != NULL) {
+    if (_respTrunc) return;
+    body = (const uint8_t*)_respBuf;
+    len = _respLen;
+  } else if (streamed) {
+    return; // the body only went to chunkCb
+  }
+  uint16_t n = _cachePathLen;
+  if (sizeof(CacheEntry) + n + len > _cacheSize) return;
+
+  // the path stays at the end of the buffer while entries are dropped, which only moves the
+  // entries below it
+  const char* path = (const char*)_cache + _cacheSize - n;
+  int16_t old = cacheFind(_cacheKey, path, n);
+  if (old >= 0) cacheRemove(old);
+  while (_cacheUsed + sizeof(CacheEntry) + n + len > _cacheSize) cacheRemove(0);
+
+  CacheEntry e;
+  e.key = _cacheKey;
+  e.status = _status;
+  e.pathLen = n;
+  e.len = len;
+  e.expires = millis() + _cacheTtl;
+  memcpy(_cache + _cacheUsed, &e, sizeof(e));
+  memmove(_cache + _cacheUsed + sizeof(e), path, n);
+  memcpy(_cache + _cacheUsed + sizeof(e) + n, body, len);
+  _cacheUsed += sizeof(e) + n + len;
 }
 
 /*! get(const char* path, const char* data)
@@ -228,11 +1086,7 @@ void ELClientRest::del(const char* path) { request(path, "DELETE", 0); }
 */
 void ELClientRest::setHeader(const char* value)
 {
-  uint8_t header_index = HEADER_GENERIC;
-  _elc->Request(CMD_REST_SETHEADER, remote_instance, 2);
-  _elc->Request(&header_index, 1);
-  _elc->Request(value, strlen(value));
-  _elc->Request();
+  sendHeader(HEADER_GENERIC, value, false);
 }
 
 /*! setContentType(const char* value)
@@ -247,11 +1101,7 @@ void ELClientRest::setHeader(const char* value)
 */
 void ELClientRest::setContentType(const char* value)
 {
-  uint8_t header_index = HEADER_CONTENT_TYPE;
-  _elc->Request(CMD_REST_SETHEADER, remote_instance, 2);
-  _elc->Request(&header_index, 1);
-  _elc->Request(value, strlen(value));
-  _elc->Request();
+  sendHeader(HEADER_CONTENT_TYPE, value, false);
 }
 
 /*! setUserAgent(const char* value)
@@ -266,17 +1116,107 @@ void ELClientRest::setContentType(const char* value)
 */
 void ELClientRest::setUserAgent(const char* value)
 {
-  uint8_t header_index = HEADER_USER_AGENT;
+  sendHeader(HEADER_USER_AGENT, value, false);
+}
+
+/*! setHeaderProfile(const ELClientRestHeader* profile, uint8_t count, boolean flash)
+@brief Set the headers for all requests from a static list
+@details The profile is registered with esp-link by begin, or right away if begin has already
+	been called. After a re-Sync esp-link has lost the headers and they are registered again
+	before the next request. Headers esp-link already has from the same unchanged string are not
+	sent again, so calling this or setHeader etc. again with the same strings costs no UART
+	traffic. esp-link keeps one header of each type, a later entry of the same type replaces an
+	earlier one.
+@param profile
+	Array of headers, must remain valid
+@param count
+	Number of headers
+@param flash
+	(optional) The array and the strings it points to are stored in program memory
+@par Example
+@code
+	const char ctJson[] PROGMEM = "application/json";
+	const char uaSensor[] PROGMEM = "sensor/1.0";
+	const ELClientRestHeader headers[] PROGMEM = {
+		{ HEADER_CONTENT_TYPE, ctJson },
+		{ HEADER_USER_AGENT, uaSensor },
+	};
+
+	rest.setHeaderProfile(headers, 2, true);
+	rest.begin("api.example.com");
+@endcode
+*/
+void ELClientRest::setHeaderProfile(const ELClientRestHeader* profile, uint8_t count, boolean flash)
+{
+  _profile = profile;
+  _profileCount = count;
+  _profileFlash = flash;
+  if (remote_instance >= 0) registerHeaders();
+}
+
+/*! registerHeaders(void)
+@brief Register the header profile with esp-link
+@details Forgets which headers esp-link has if it lost them due to a re-Sync.
+@note Internal library function
+*/
+void ELClientRest::registerHeaders(void)
+{
+  if (_headerSync != _elc->_syncCount) _headerSent = 0;
+  _headerSync = _elc->_syncCount;
+  for (uint8_t i=0; i<_profileCount; i++) {
+    ELClientRestHeader h;
+    if (_profileFlash) memcpy_P(&h, &_profile[i], sizeof(h));
+    else               h = _profile[i];
+    sendHeader(h.type, h.value, _profileFlash);
+  }
+}
+
+/*! sendHeader(uint8_t type, const char* value, boolean flash)
+@brief Send a header to esp-link unless it has it already
+@details The header is only skipped if it was last sent from the same string with the same length and
+	CRC, so a different value is always sent, and a value changed in place is missed only in the rare
+	case that its CRC collides.
+@note Internal library function
+@param type
+	Header type
+@param value
+	Header value
+@param flash
+	Value is stored in program memory
+*/
+void ELClientRest::sendHeader(uint8_t type, const char* value, boolean flash)
+{
+  if (type > HEADER_USER_AGENT) return;
+  ELClientBlock block = { value, (uint16_t)(flash ? strlen_P(value) : strlen(value)), flash };
+  uint16_t hash = 0;
+  for (uint16_t i=0; i<block.len; i++)
+    hash = _elc->crc16Add(flash ? pgm_read_byte(value + i) : value[i], hash);
+  uint8_t bit = 1 << type;
+  if (_headerSync == _elc->_syncCount && (_headerSent & bit) && _headerValue[type] == value &&
+      ((_headerFlash & bit) != 0) == flash && _headerLen[type] == block.len && _headerHash[type] == hash)
+    return;
+
+  if (_headerSync != _elc->_syncCount) _headerSent = 0;
+  _headerSync = _elc->_syncCount;
+  _headerSent |= bit;
+  if (flash) _headerFlash |= bit;
+  else       _headerFlash &= ~bit;
+  _headerValue[type] = value;
+  _headerLen[type] = block.len;
+  _headerHash[type] = hash;
+
+  uint8_t header_index = type;
   _elc->Request(CMD_REST_SETHEADER, remote_instance, 2);
   _elc->Request(&header_index, 1);
-  _elc->Request(value, strlen(value));
+  _elc->Request(&ELClient::PrintBlock, &block, block.len);
   _elc->Request();
 }
 
 /*! getResponse(char* data, uint16_t maxLen)
 @brief Retrieve response.
 @details Checks if a response from the remote server was received,
-	returns the HTTP status code or 0 if no response (may need to wait longer)
+	returns the HTTP status code or 0 if no response (may need to wait longer).
+	With a response buffer the body is copied from there, data may be NULL to leave it there.
 @param data
 	Pointer to buffer for received packet
 @param maxLen
@@ -321,7 +1261,11 @@ void ELClientRest::setUserAgent(const char* value)
 uint16_t ELClientRest::getResponse(char* data, uint16_t maxLen)
 {
   if (_status == 0) return 0;
-  memcpy(data, _data, _len>maxLen?maxLen:_len);
+  if (_respBuf != NULL) {
+    if (data != NULL) memcpy(data, _respBuf, _respLen>maxLen?maxLen:_respLen);
+  } else {
+    memcpy(data, _data, _len>maxLen?maxLen:_len);
+  }
   int16_t s = _status;
   _status = 0;
   return s;
@@ -377,5 +1321,235 @@ uint16_t ELClientRest::waitResponse(char* data, uint16_t maxLen, uint32_t timeou
   while (_status == 0 && (millis() - wait < timeout)) {
     _elc->Process();
   }
+  if (_status == 0) recordLatency(true);
   return getResponse(data, maxLen);
 }
+
+/*! raw(const char* text)
+@brief Append text as-is
+@param text
+	Text, e.g. "/update"
+*/
+void ELClientRestPath::raw(const char* text) { _out->print(text); }
+
+/*! raw(const __FlashStringHelper* text)
+@brief Append text in program memory as-is
+@param text
+	Text, e.g. F("/update")
+*/
+void ELClientRestPath::raw(const __FlashStringHelper* text) { _out->print(text); }
+
+/*! segment(const char* text)
+@brief Append a slash and a URL-encoded path segment
+@param text
+	Segment
+*/
+void ELClientRestPath::segment(const char* text)
+{
+  _out->write('/');
+  encode(text, false);
+}
+
+/*! segment(const __FlashStringHelper* text)
+@brief Append a slash and a URL-encoded path segment in program memory
+@param text
+	Segment
+*/
+void ELClientRestPath::segment(const __FlashStringHelper* text)
+{
+  _out->write('/');
+  encode((const char*)text, true);
+}
+
+/*! segment(long value)
+@brief Append a slash and a number as path segment
+@param value
+	Number
+*/
+void ELClientRestPath::segment(long value)
+{
+  _out->write('/');
+  _out->print(value);
+}
+
+/*! segment(unsigned long value)
+@brief Append a slash and an unsigned number as path segment
+@param value
+	Number
+*/
+void ELClientRestPath::segment(unsigned long value)
+{
+  _out->write('/');
+  _out->print(value);
+}
+
+/*! param(const char* key, const char* value)
+@brief Append a query parameter with a URL-encoded string value
+@param key
+	Parameter name
+@param value
+	Parameter value
+@par Example
+@code
+	path.param("q", "living room"); // ?q=living%20room
+@endcode
+*/
+void ELClientRestPath::param(const char* key, const char* value)
+{
+  this->key(key, false);
+  encode(value, false);
+}
+
+/*! param(const __FlashStringHelper* key, const char* value)
+@brief Append a query parameter with a URL-encoded string value
+@param key
+	Parameter name in program memory
+@param value
+	Parameter value
+*/
+void ELClientRestPath::param(const __FlashStringHelper* key, const char* value)
+{
+  this->key((const char*)key, true);
+  encode(value, false);
+}
+
+/*! param(const char* key, long value)
+@brief Append a query parameter with an integer value
+@param key
+	Parameter name
+@param value
+	Parameter value
+*/
+void ELClientRestPath::param(const char* key, long value)
+{
+  this->key(key, false);
+  _out->print(value);
+}
+
+/*! param(const __FlashStringHelper* key, long value)
+@brief Append a query parameter with an integer value
+@param key
+	Parameter name in program memory
+@param value
+	Parameter value
+*/
+void ELClientRestPath::param(const __FlashStringHelper* key, long value)
+{
+  this->key((const char*)key, true);
+  _out->print(value);
+}
+
+/*! param(const char* key, unsigned long value)
+@brief Append a query parameter with an unsigned integer value
+@param key
+	Parameter name
+@param value
+	Parameter value
+*/
+void ELClientRestPath::param(const char* key, unsigned long value)
+{
+  this->key(key, false);
+  _out->print(value);
+}
+
+/*! param(const __FlashStringHelper* key, unsigned long value)
+@brief Append a query parameter with an unsigned integer value
+@param key
+	Parameter name in program memory
+@param value
+	Parameter value
+*/
+void ELClientRestPath::param(const __FlashStringHelper* key, unsigned long value)
+{
+  this->key((const char*)key, true);
+  _out->print(value);
+}
+
+/*! param(const char* key, float value, uint8_t decimals)
+@brief Append a query parameter with a fixed-point value
+@param key
+	Parameter name
+@param value
+	Parameter value
+@param decimals
+	Number of decimals, at most 6
+@par Example
+@code
+	path.param("field1", 21.456, 2); // ?field1=21.46
+@endcode
+*/
+void ELClientRestPath::param(const char* key, float value, uint8_t decimals)
+{
+  this->key(key, false);
+  fixed(value, decimals);
+}
+
+/*! param(const __FlashStringHelper* key, float value, uint8_t decimals)
+@brief Append a query parameter with a fixed-point value
+@param key
+	Parameter name in program memory
+@param value
+	Parameter value
+@param decimals
+	Number of decimals, at most 6
+*/
+void ELClientRestPath::param(const __FlashStringHelper* key, float value, uint8_t decimals)
+{
+  this->key((const char*)key, true);
+  fixed(value, decimals);
+}
+
+/*! key(const char* key, boolean flash)
+@brief Append the separator, the URL-encoded key and the equal sign of a query parameter
+@note Internal library function
+*/
+void ELClientRestPath::key(const char* key, boolean flash)
+{
+  _out->write(_query ? '&' : '?');
+  _query = true;
+  encode(key, flash);
+  _out->write('=');
+}
+
+/*! encode(const char* text, boolean flash)
+@brief Append URL-encoded text, only unreserved characters are left as they are
+@note Internal library function
+*/
+void ELClientRestPath::encode(const char* text, boolean flash)
+{
+  static const char hex[] = "0123456789ABCDEF";
+  for (;;) {
+    char c = flash ? pgm_read_byte(text++) : *text++;
+    if (c == 0) break;
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+        c == '-' || c == '_' || c == '.' || c == '~') {
+      _out->write(c);
+    } else {
+      _out->write('%');
+      _out->write(hex[(uint8_t)c >> 4]);
+      _out->write(hex[c & 0xF]);
+    }
+  }
+}
+
+/*! fixed(float value, uint8_t decimals)
+@brief Append a float as fixed-point number without going through a string
+@note Internal library function
+*/
+void ELClientRestPath::fixed(float value, uint8_t decimals)
+{
+  if (decimals > 6) decimals = 6;
+  uint32_t scale = 1;
+  for (uint8_t i=0; i<decimals; i++) scale *= 10;
+  boolean negative = value < 0;
+  if (negative) value = -value;
+  uint32_t v = (uint32_t)(value * scale + 0.5f);
+  // values that round to zero are printed without sign
+  if (negative && v != 0) _out->write('-');
+  _out->print(v / scale);
+  if (decimals == 0) return;
+  _out->write('.');
+  uint32_t frac = v % scale;
+  for (uint32_t d = scale / 10; d > 0; d /= 10)
+    _out->write('0' + (frac / d) % 10);
+}
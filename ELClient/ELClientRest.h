@@ -20,31 +20,160 @@ typedef enum {
   HTTP_STATUS_OK = 200 /**< HTTP status OK response. */
 } HTTP_STATUS;
 
+typedef enum {
+  HEADER_GENERIC = 0,    /**< Header is generic */
+  HEADER_CONTENT_TYPE,   /**< Header is content type */
+  HEADER_USER_AGENT      /**< Header is user agent */
+} HEADER_TYPE; /**< Enum of header types */
+
+// One entry of a header profile, see ELClientRest::setHeaderProfile
+typedef struct {
+  uint8_t type;          /**< HEADER_GENERIC, HEADER_CONTENT_TYPE or HEADER_USER_AGENT */
+  const char* value;     /**< Header value */
+} ELClientRestHeader;
+
+// Total length of a response body that esp-link doesn't know yet, e.g. with chunked encoding
+#define REST_LENGTH_UNKNOWN 0xFFFFFFFFUL /**< Response body length not known yet */
+
+typedef enum {
+  REST_STATUS = 0, /**< Response status arrived, no data */
+  REST_BODY,       /**< Piece of the response body */
+  REST_DONE        /**< Response is complete, offset is the number of body bytes received */
+} REST_EVENT;
+
+// Event passed to chunkCb while a response streams in. Each response produces one REST_STATUS,
+// zero or more REST_BODY events with consecutive pieces of the body and one REST_DONE. If a
+// fragment gets lost the response ends early with REST_DONE and offset < total.
+typedef struct {
+  REST_EVENT event;      /**< What happened */
+  int16_t status;        /**< HTTP status code of the response */
+  const uint8_t* data;   /**< REST_BODY: piece of the body, only valid during the callback */
+  uint16_t len;          /**< REST_BODY: number of bytes at data */
+  uint32_t offset;       /**< Offset of data within the body, REST_DONE: bytes received */
+  uint32_t total;        /**< Total length of the body, or REST_LENGTH_UNKNOWN */
+} ELClientRestChunk;
+
+#define REST_LATENCY_BUCKETS 12 /**< Number of buckets of the latency histogram */
+
+// Latency histogram of REST requests, see ELClientRest::setLatencyStats. Bucket i counts the
+// responses that took less than 16 << i ms (16ms, 32ms, ... 16.4s), the last bucket counts all
+// slower ones. Counts stop at 65535.
+typedef struct {
+  uint16_t path;         /**< Hash of the path up to the query string, 0 for all requests */
+  uint16_t timeouts;     /**< Number of requests that timed out */
+  uint16_t buckets[REST_LATENCY_BUCKETS]; /**< Number of responses per latency bucket */
+  uint32_t sum;          /**< Sum of the latencies in milliseconds, for the mean */
+  uint16_t max;          /**< Largest latency in milliseconds, at most 65535 */
+} ELClientRestLatency;
+
+#define REST_RETRY_TIMEOUT 0x01 /**< Retry requests that timed out */
+#define REST_RETRY_5XX     0x02 /**< Retry requests that got a 5xx server error */
+
+// A queued REST request, see ELClientRest::setQueue. The path, method and data are not copied
+// and must remain valid until doneCb has been called.
+typedef struct {
+  const char* path;        /**< Path of the request */
+  const char* method;      /**< REST method */
+  const char* data;        /**< Request body, NULL if none */
+  uint16_t len;            /**< Length of the request body */
+  FP<void, void*> doneCb;  /**< Called with a pointer to this request when it completes */
+  void* ctx;               /**< Free for use by doneCb */
+  int16_t status;          /**< HTTP status code, 0 if the request timed out */
+  uint8_t attempts;        /**< Number of times the request was sent */
+  uint32_t queuedAt;       /**< millis() when the request was queued */
+  uint32_t sentAt;         /**< millis() when the request was last sent to esp-link */
+  uint32_t doneAt;         /**< millis() when the response arrived or the request timed out */
+} ELClientRestRequest;
+
+// ELClientRestPath writes a request path with URL-encoded segments and query parameters straight
+// into the outgoing request. It is used in a producer passed to ELClientRest::request, which is
+// run twice: once to measure the length of the path and once to send it, so no buffer is needed.
+// Floats are printed as fixed-point numbers with up to 6 decimals and must fit into 32 bits
+// when scaled, e.g. abs(value) < 4294 with 6 decimals.
+class ELClientRestPath {
+  public:
+    ELClientRestPath(Print* out) : _out(out), _query(false) {}
+
+    // Append text as-is, e.g. "/update"
+    void raw(const char* text);
+    void raw(const __FlashStringHelper* text);
+
+    // Append a slash and the URL-encoded segment
+    void segment(const char* text);
+    void segment(const __FlashStringHelper* text);
+    void segment(long value);
+    void segment(unsigned long value);
+    void segment(int value) { segment((long)value); }
+    void segment(unsigned int value) { segment((unsigned long)value); }
+
+    // Append ?key=value for the first parameter and &key=value for later ones, URL-encoded
+    void param(const char* key, const char* value);
+    void param(const __FlashStringHelper* key, const char* value);
+    void param(const char* key, long value);
+    void param(const __FlashStringHelper* key, long value);
+    void param(const char* key, unsigned long value);
+    void param(const __FlashStringHelper* key, unsigned long value);
+    // int overloads so that e.g. param("n", 0) isn't taken for a NULL string
+    void param(const char* key, int value) { param(key, (long)value); }
+    void param(const __FlashStringHelper* key, int value) { param(key, (long)value); }
+    void param(const char* key, unsigned int value) { param(key, (unsigned long)value); }
+    void param(const __FlashStringHelper* key, unsigned int value) { param(key, (unsigned long)value); }
+    void param(const char* key, float value, uint8_t decimals);
+    void param(const __FlashStringHelper* key, float value, uint8_t decimals);
+
+  private:
+    void encode(const char* text, boolean flash);
+    void key(const char* key, boolean flash);
+    void fixed(float value, uint8_t decimals);
+
+    Print* _out;     /**< Output, the request argument or a measuring Print */
+    boolean _query;  /**< A query parameter has been appended */
+};
+
 // The ELClientRest class makes simple REST requests to a remote server. Each instance
 // is used to communicate with one server and multiple instances can be created to make
 // requests to multiple servers.
 // The ELClientRest class does not support concurrent requests to the same server because
 // only a single response can be recevied at a time and the responses of the two requests
-// may arrive out of order.
-// A major limitation of the REST class is that it does not store the response body. The
+// may arrive out of order. Use setQueue and enqueue to have requests sent one after the other.
+// A major limitation of the REST class is that by default it does not store the response body
+// (use setResponseBuffer or ELClientRestBuffered to have it copied on arrival). The
 // response status is saved in the class instance, so after a request completes and before
 // the next request is made a call to getResponse will return the status. However, only a pointer
 // to the response body is saved, which means that if any other message arrives and is
 // processed then the response body is overwritten by it. What this means is that if you
 // need the response body you best use waitResponse or ensure that any call to ELClient::process
-// is followed by a call to getResponse. Ideally someone improves this class to take a callback
-// into the user's sketch?
+// is followed by a call to getResponse. Alternatively attach chunkCb, which receives the status
+// and then the body piece by piece as it arrives.
 // Another limitation is that the response body is 100 chars long at most, this is due to the
-// limitation of the SLIP protocol buffer available.
-class ELClientRest {
+// limitation of the SLIP protocol buffer available. This does not apply to chunkCb, esp-link
+// sends larger responses in fragments to it.
+class ELClientRest : public ELClientService {
   public:
     ELClientRest(ELClient *e);
 
     // Initialize communication to a remote server, this communicates with esp-link but does not
     // open a connection to the remote server. Host may be a hostname or an IP address,
-    // security causes HTTPS to be used (not yet supported). Returns 0 if the set-up is
-    // successful, returns a negative error code if it failed.
-    int begin(const char* host, uint16_t port=80, boolean security=false);
+    // security causes HTTPS to be used (not yet supported). Optionally a response buffer can be
+    // given, see setResponseBuffer. Returns 0 if the set-up is successful, returns a negative
+    // error code if it failed.
+    int begin(const char* host, uint16_t port=80, boolean security=false,
+        char* respBuf=NULL, uint16_t respSize=0);
+
+    // Copy response bodies into buf as they arrive, so they survive later calls to
+    // ELClient::Process and several instances can have responses outstanding at the same time.
+    // The body is null-terminated, so at most size-1 bytes are stored. Must be called before
+    // begin, esp-link then sends responses that don't fit into the protocol buffer in fragments.
+    void setResponseBuffer(char* buf, uint16_t size);
+
+    // Body of the last response in the response buffer, null-terminated
+    const char* response(void) { return _respBuf; }
+    // Number of bytes stored in the response buffer
+    uint16_t responseLen(void) { return _respLen; }
+    // Total length of the last response body as reported by esp-link
+    uint32_t responseTotal(void) { return _respTotal; }
+    // True if the last response body did not fit into the response buffer or was cut short
+    boolean truncated(void) { return _respTrunc; }
 
     // Make a request to the remote server. The data must be null-terminated
     void request(const char* path, const char* method, const char* data=NULL);
@@ -52,6 +181,10 @@ class ELClientRest {
     // Make a request to the remote server.
     void request(const char* path, const char* method, const char* data, int len);
 
+    // Make a request to the remote server with a path printed by a producer, usually using
+    // ELClientRestPath. The data must be null-terminated.
+    void request(ELClientProducer path, void* ctx, const char* method, const char* data=NULL);
+
     // Make a GET request to the remote server with NULL-terminated data
     void get(const char* path, const char* data=NULL);
 
@@ -82,6 +215,70 @@ class ELClientRest {
     // Set a custom header for all subsequent requests
     void setHeader(const char* value);
 
+    // Set the headers for all requests from a static list, which is registered with esp-link by
+    // begin and again before the next request after esp-link lost it due to a re-Sync. With
+    // flash the list and the strings it points to are in program memory. Headers esp-link
+    // already has from the same unchanged string, also ones set with setHeader etc., are not
+    // sent again.
+    void setHeaderProfile(const ELClientRestHeader* profile, uint8_t count, boolean flash=false);
+
+    // Use slots as a queue of up to size requests. Queued requests are sent one at a time, the
+    // next one when the response to the previous one has arrived or timeout ms have passed.
+    void setQueue(ELClientRestRequest* slots, uint8_t size, uint32_t timeout=DEFAULT_REST_TIMEOUT);
+
+    // Queue a request, returns the queue entry so doneCb and ctx can be set, or NULL if the queue
+    // is full. The data must be null-terminated.
+    ELClientRestRequest* enqueue(const char* path, const char* method, const char* data=NULL);
+
+    // Queue a request with len bytes of data
+    ELClientRestRequest* enqueue(const char* path, const char* method, const char* data, uint16_t len);
+
+    // Number of queued requests, including the one waiting for its response
+    uint8_t queued(void) { return _qCount; }
+
+    // Retry queued requests that timed out or got a 5xx error (see retryOn) up to maxAttempts
+    // times in total. The first retry is after baseDelay ms, each further one doubles the delay up
+    // to maxDelay, and up to jitter percent of each delay is cut off at random so that several
+    // devices don't retry in lockstep. doneCb is only called with the final outcome.
+    void setRetry(uint8_t maxAttempts, uint16_t baseDelay=1000, uint16_t maxDelay=30000,
+        uint8_t jitter=50, uint8_t retryOn=REST_RETRY_TIMEOUT|REST_RETRY_5XX);
+
+    // Time out the request in flight, called from ELClient::Process()
+    virtual void service(uint32_t now);
+
+    // Measure the time from sending each request to the arrival of its response. stats[0] gets
+    // all requests, further entries get the requests of one path each, in the order the paths
+    // are first seen. Pass NULL to stop measuring.
+    void setLatencyStats(ELClientRestLatency* stats, uint8_t count);
+    // Clear the latency stats
+    void resetLatencyStats(void);
+    // Latency in milliseconds that pct percent of the responses in stats[entry] stayed below,
+    // rounded up to a bucket bound, e.g. for choosing a timeout. 0 if there are no responses.
+    uint32_t latencyPercentile(uint8_t entry, uint8_t pct);
+    // Producer that prints the latency stats of the ELClientRest passed as ctx as JSON, e.g. to
+    // publish them over MQTT
+    static boolean printLatency(Print* out, uint16_t chunk, void* ctx);
+
+    // Cache responses to cachedGet in buf, which holds as many as fit into size bytes
+    void setCache(uint8_t* buf, uint16_t size);
+    // Drop all cached responses
+    void clearCache(void);
+    // Drop the cached response for path, e.g. after changing the resource
+    void invalidate(const char* path);
+    // GET path from the cache if a response younger than ttl ms is cached, returns true and the
+    // response is available right away to getResponse, response and chunkCb. Otherwise sends a
+    // GET request as get does, or queues it as enqueue does if a queue is set up, returns false
+    // and caches the response when it arrives.
+    boolean cachedGet(const char* path, uint32_t ttl);
+
+    uint32_t cacheHits;   /**< Number of cachedGet calls served from the cache */
+    uint32_t cacheMisses; /**< Number of cachedGet calls sent to the server */
+
+    // Callback for streamed responses, called with a pointer to an ELClientRestChunk. If attached
+    // before begin, esp-link sends responses that don't fit into the protocol buffer in fragments
+    // so they can be consumed incrementally in constant RAM.
+    FP<void, void*> chunkCb;
+
   private:
     int32_t remote_instance; /**< Connection number, value can be 0 to 3 */
     ELClient *_elc; /**< ELClient instance */
@@ -92,6 +289,81 @@ class ELClientRest {
     uint16_t _len; /**< Number of sent/received bytes */
     void *_data; /**< Buffer for received data */
 
+    boolean _streaming;  /**< A streamed response is in progress */
+    uint32_t _next;      /**< Offset of the next expected fragment of a streamed response */
+    void streamChunk(ELClientRestChunk* chunk);
+    void bufferChunk(ELClientRestChunk* chunk);
+    void dispatch(void);
+    void complete(int16_t status);
+    boolean retry(ELClientRestRequest* req);
+    void startLatency(const char* path);
+    void recordLatency(boolean timeout);
+    static void addLatency(ELClientRestLatency* stats, uint32_t ms, boolean timeout);
+    static uint16_t cacheKey(const char* method, const char* path);
+    int16_t cacheFind(uint16_t key, const char* path, uint16_t pathLen);
+    boolean cacheReserve(const char* path);
+    void cacheRemove(uint16_t offset);
+    void cacheStore(boolean streamed);
+    void sendHeader(uint8_t type, const char* value, boolean flash);
+    void registerHeaders(void);
+
+    const ELClientRestHeader* _profile; /**< Header profile, NULL if none */
+    uint8_t _profileCount;  /**< Number of entries in the header profile */
+    boolean _profileFlash;  /**< Header profile is stored in program memory */
+    uint8_t _headerSync;    /**< ELClient::_syncCount when the headers were registered */
+    uint8_t _headerSent;    /**< Bit mask of the header types esp-link has */
+    uint8_t _headerFlash;   /**< Bit mask of the header types whose value was in program memory */
+    const char* _headerValue[3]; /**< Value of each header type esp-link has */
+    uint16_t _headerLen[3];  /**< Length of the value of each header type esp-link has */
+    uint16_t _headerHash[3]; /**< CRC of the value of each header type esp-link has */
+
+    char* _respBuf;       /**< Response buffer, NULL if none */
+    uint16_t _respSize;   /**< Size of the response buffer */
+    uint16_t _respLen;    /**< Number of bytes stored in the response buffer */
+    uint32_t _respTotal;  /**< Total length of the last response body */
+    boolean _respTrunc;   /**< The last response body did not fit or was cut short */
+
+    ELClientRestRequest* _queue; /**< Request queue slots, NULL if none */
+    uint8_t _qSize;       /**< Number of request queue slots */
+    uint8_t _qHead;       /**< Slot of the oldest queued request */
+    uint8_t _qCount;      /**< Number of queued requests */
+    boolean _qBusy;       /**< The oldest queued request has been sent */
+    uint32_t _qTimeout;   /**< Timeout for queued requests in milliseconds */
+    boolean _qRetry;      /**< The oldest queued request waits to be retried */
+    uint32_t _retryAt;    /**< millis() when the oldest queued request is to be retried */
+    uint8_t _retryMax;    /**< Maximum number of attempts */
+    uint8_t _retryJitter; /**< Percentage of the retry delay that is randomized */
+    uint8_t _retryOn;     /**< Which failures are retried, REST_RETRY_TIMEOUT and REST_RETRY_5XX */
+    uint16_t _retryBase;  /**< Delay before the first retry in milliseconds */
+    uint16_t _retryMaxDelay; /**< Maximum delay between retries in milliseconds */
+
+    ELClientRestLatency* _lat; /**< Latency stats, NULL if not measuring */
+    uint8_t _latCount;    /**< Number of latency stats entries */
+    boolean _latPending;  /**< A request is being timed */
+    uint16_t _latPath;    /**< Path hash of the request being timed, 0 if unknown */
+    uint32_t _latSent;    /**< millis() when the request being timed was sent */
+
+    uint8_t* _cache;      /**< Response cache, NULL if none */
+    uint16_t _cacheSize;  /**< Size of the response cache */
+    uint16_t _cacheUsed;  /**< Number of bytes used in the response cache */
+    boolean _cachePending; /**< The response to the request in flight is to be cached */
+    uint16_t _cacheKey;   /**< Key of the response to be cached */
+    uint16_t _cachePathLen; /**< Length of its path, kept at the end of the cache until it arrives */
+    uint32_t _cacheTtl;   /**< Time to live of the response to be cached */
+    uint8_t _cacheSlot;   /**< Queue slot of the request whose response is to be cached, 0xFF if none */
+
 
 };
+
+// ELClientRest with a response buffer of SIZE bytes inside the instance, e.g.
+// ELClientRestBuffered<200> rest(&esp);
+template<uint16_t SIZE>
+class ELClientRestBuffered : public ELClientRest {
+  public:
+    ELClientRestBuffered(ELClient *e) : ELClientRest(e) { setResponseBuffer(_buf, SIZE); }
+
+  private:
+    char _buf[SIZE]; /**< Response buffer */
+};
+
 #endif // _EL_CLIENT_REST_H_
@@ -0,0 +1,244 @@
+/*! \file ELClientRestPool.cpp
+    \brief Constructor and functions for ELClientRestPool
+*/
+#include "ELClientRestPool.h"
+
+/*! ELClientRestPool(ELClient* e)
+@brief Constructor for ELClientRestPool
+@param e
+  Pointer to ELClient structure
+@par Example
+@code
+  ELClientRest rest1(&esp), rest2(&esp), rest3(&esp), rest4(&esp);
+  ELClientRestPool pool(&esp);
+@endcode
+*/
+ELClientRestPool::ELClientRestPool(ELClient* e) :completed(0), errors(0), timeouts(0), _elc(e), _count(0),
+    _active(0), _timeout(DEFAULT_REST_TIMEOUT), _statsAt(0), _queue(0), _qSize(0), _qHead(0),
+    _qCount(0) {}
+
+/*! add(ELClientRest* conn)
+@brief Add a connection to the pool
+@details The pool uses the request queue of the connection, it must not be used directly.
+@param conn
+  Connection, not yet set up with begin
+@return <code>boolean</code>
+  False if the pool already has REST_POOL_MAX connections
+*/
+boolean ELClientRestPool::add(ELClientRest* conn) {
+  if (_count == REST_POOL_MAX) return false;
+  _conn[_count++] = conn;
+  _active = _count;
+  return true;
+}
+
+/*! begin(const char* host, uint16_t port, boolean security)
+@brief Set up all connections of the pool to a REST server
+@param host
+  Host to be connected. Can be a URL or an IP address in the format of xxx.xxx.xxx.xxx .
+@param port
+  (optional) Port of the server, defaults to 80
+@param security
+  (optional) Flag if secure connection should be established
+@return <code>uint8_t</code>
+  Number of connections that were set up
+@par Example
+@code
+  pool.add(&rest1);
+  pool.add(&rest2);
+  pool.add(&rest3);
+  pool.add(&rest4);
+  if (pool.begin("api.thingspeak.com") == 0) Serial.println("REST begin failed");
+@endcode
+*/
+uint8_t ELClientRestPool::begin(const char* host, uint16_t port, boolean security) {
+  uint8_t n = 0;
+  for (uint8_t i=0; i<_count; i++) {
+    if (_conn[i]->begin(host, port, security) != 0) continue;
+    _conn[n] = _conn[i];
+    _conn[n]->setQueue(&_slot[n], 1, _timeout);
+    n++;
+  }
+  _count = _active = n;
+  _elc->attachService(this);
+  resetStats();
+  return n;
+}
+
+/*! setQueue(ELClientRestRequest* slots, uint8_t size, uint32_t timeout)
+@brief Set up the queue of requests waiting for an idle connection
+@param slots
+  Array of queue entries
+@param size
+  Number of queue entries
+@param timeout
+  (optional) Time in milliseconds to wait for each response, defaults to 5000ms
+*/
+void ELClientRestPool::setQueue(ELClientRestRequest* slots, uint8_t size, uint32_t timeout) {
+  _queue = size > 0 ? slots : NULL;
+  _qSize = size;
+  _qHead = 0;
+  _qCount = 0;
+  _timeout = timeout;
+  for (uint8_t i=0; i<_count; i++)
+    _conn[i]->setQueue(&_slot[i], 1, _timeout);
+}
+
+/*! enqueue(const char* path, const char* method, const char* data)
+@brief Queue a request
+@details The data must be null-terminated. The path, method and data are not copied.
+@param path
+  Path that extends the URL of the REST request
+@param method
+  REST method, allowed values are "GET", "POST", "PUT" or "DELETE"
+@param data
+  (optional) Pointer to data buffer
+@return <code>ELClientRestRequest*</code>
+  Queue entry of the request, NULL if the queue is full
+*/
+ELClientRestRequest* ELClientRestPool::enqueue(const char* path, const char* method,
+    const char* data)
+{
+  return enqueue(path, method, data, data != NULL ? strlen(data) : 0);
+}
+
+/*! enqueue(const char* path, const char* method, const char* data, uint16_t len)
+@brief Queue a request
+@details The path, method and data are not copied. The request waits in the queue until a
+  connection is idle, which is checked from ELClient::Process(). doneCb is called with a pointer to
+  a copy of the returned entry, use ctx to identify the request.
+@param path
+  Path that extends the URL of the REST request
+@param method
+  REST method, allowed values are "GET", "POST", "PUT" or "DELETE"
+@param data
+  Pointer to data buffer
+@param len
+  Size of data buffer
+@return <code>ELClientRestRequest*</code>
+  Queue entry of the request, NULL if the queue is full
+@par Example
+@code
+  void updateDone(void* r) {
+    ELClientRestRequest* req = (ELClientRestRequest*)r;
+    Serial.print((int)req->ctx);
+    Serial.print(": ");
+    Serial.println(req->status);
+  }
+
+  for (int i=0; i<8; i++) {
+    ELClientRestRequest* req = pool.enqueue(paths[i], "GET");
+    req->doneCb.attach(updateDone);
+    req->ctx = (void*)i;
+  }
+@endcode
+*/
+ELClientRestRequest* ELClientRestPool::enqueue(const char* path, const char* method,
+    const char* data, uint16_t len)
+{
+  if (_queue == NULL || _qCount == _qSize) return NULL;
+  ELClientRestRequest* req = &_queue[(_qHead + _qCount) % _qSize];
+  req->path = path;
+  req->method = method;
+  req->data = data;
+  req->len = len;
+  req->doneCb.detach();
+  req->ctx = NULL;
+  req->status = 0;
+  req->queuedAt = millis();
+  req->sentAt = 0;
+  req->doneAt = 0;
+  _qCount++;
+  return req;
+}
+
+/*! inFlight(void)
+@brief Number of requests sent and waiting for their response
+@return <code>uint8_t</code>
+  Number of requests in flight
+*/
+uint8_t ELClientRestPool::inFlight(void) {
+  uint8_t n = 0;
+  for (uint8_t i=0; i<_count; i++)
+    if (_conn[i]->queued() > 0) n++;
+  return n;
+}
+
+/*! resetStats(void)
+@brief Reset completed, errors, timeouts and the throughput measurement
+*/
+void ELClientRestPool::resetStats(void) {
+  completed = 0;
+  errors = 0;
+  timeouts = 0;
+  _statsAt = millis();
+}
+
+/*! throughput(void)
+@brief Successful requests per minute since resetStats
+@details Only requests that got a 2xx response are counted, so a server that answers with errors does not
+  look fast.
+@return <code>uint32_t</code>
+  Requests per minute
+@par Example
+@code
+  for (uint8_t n=1; n<=pool.connections(); n++) {
+    pool.setActive(n);
+    pool.resetStats();
+    ... keep the queue full for a minute ...
+    Serial.print(n);
+    Serial.print(" connections: ");
+    Serial.print(pool.throughput());
+    Serial.println(" requests/min");
+  }
+@endcode
+*/
+uint32_t ELClientRestPool::throughput(void) {
+  uint32_t elapsed = millis() - _statsAt;
+  if (elapsed == 0) return 0;
+  return (uint64_t)completed * 60000 / elapsed;
+}
+
+/*! service(uint32_t now)
+@brief Send waiting requests on idle connections
+@note Internal library function, called from ELClient::Process()
+@param now
+  Current time in milliseconds
+*/
+void ELClientRestPool::service(uint32_t) {
+  dispatch();
+}
+
+/*! dispatch(void)
+@brief Send the oldest waiting requests on idle connections
+@note Internal library function
+*/
+void ELClientRestPool::dispatch(void) {
+  for (uint8_t i=0; i<_active && _qCount > 0; i++) {
+    if (_conn[i]->queued() > 0) continue;
+    ELClientRestRequest* wait = &_queue[_qHead];
+    ELClientRestRequest* req = _conn[i]->enqueue(wait->path, wait->method, wait->data, wait->len);
+    if (req == NULL) continue;
+    req->queuedAt = wait->queuedAt;
+    req->ctx = wait->ctx;
+    req->doneCb.attach(this, &ELClientRestPool::doneCallback);
+    _userCb[i] = wait->doneCb;
+    _qHead = (_qHead + 1) % _qSize;
+    _qCount--;
+  }
+}
+
+/*! doneCallback(void* req)
+@brief Count a finished request as completed, error or timeout and pass it on to its doneCb
+@note Internal library function
+@param req
+  Pointer to the ELClientRestRequest of the connection
+*/
+void ELClientRestPool::doneCallback(void* req) {
+  ELClientRestRequest* r = (ELClientRestRequest*)req;
+  uint8_t i = r - _slot;
+  if (r->status == 0)                          timeouts++;
+  else if (r->status >= 200 && r->status < 300) completed++;
+  else                                          errors++;
+  if (_userCb[i].attached()) _userCb[i](r);
+}
@@ -0,0 +1,87 @@
+/*! \file ELClientRestPool.h
+    \brief Definitions for ELClientRestPool
+*/
+// Scheduling of REST requests onto several connections to the same server
+
+#ifndef _EL_CLIENT_REST_POOL_H_
+#define _EL_CLIENT_REST_POOL_H_
+
+#include <Arduino.h>
+#include "FP.h"
+#include "ELClient.h"
+#include "ELClientRest.h"
+
+#define REST_POOL_MAX 4 /**< Maximum number of connections, esp-link supports 4 REST clients */
+
+// ELClientRestPool spreads queued requests over up to four ELClientRest connections to the same
+// server. Each connection has one request in flight at a time and its response arrives on its own
+// callback, so responses are routed to the right request even when they arrive out of order.
+// Requests are sent in the order they were queued, each on the first idle connection. The pool
+// counts successful, failed and timed-out requests to measure the throughput, e.g. with 1 to 4
+// active connections.
+class ELClientRestPool : public ELClientService {
+  public:
+    ELClientRestPool(ELClient* e);
+
+    // Add a connection to the pool, must be done before begin, returns false if the pool is full
+    boolean add(ELClientRest* conn);
+
+    // Set up all connections to the server, see ELClientRest::begin. Returns the number of
+    // connections that were set up, connections that failed are removed from the pool.
+    uint8_t begin(const char* host, uint16_t port=80, boolean security=false);
+
+    // Use slots as a queue of up to size requests waiting for an idle connection
+    void setQueue(ELClientRestRequest* slots, uint8_t size, uint32_t timeout=DEFAULT_REST_TIMEOUT);
+
+    // Queue a request, returns the queue entry so doneCb and ctx can be set, or NULL if the queue
+    // is full. The data must be null-terminated. doneCb is called with a pointer to a copy of the
+    // entry with the status and timing filled in.
+    ELClientRestRequest* enqueue(const char* path, const char* method, const char* data=NULL);
+
+    // Queue a request with len bytes of data
+    ELClientRestRequest* enqueue(const char* path, const char* method, const char* data, uint16_t len);
+
+    // Number of requests waiting for an idle connection
+    uint8_t waiting(void) { return _qCount; }
+    // Number of requests in flight
+    uint8_t inFlight(void);
+
+    // Number of connections in the pool
+    uint8_t connections(void) { return _count; }
+    // Use only the first n connections for new requests, to compare the throughput
+    void setActive(uint8_t n) { _active = n > _count ? _count : n; }
+    // Number of connections used for new requests
+    uint8_t active(void) { return _active; }
+
+    // Reset completed, errors, timeouts and the throughput measurement
+    void resetStats(void);
+    // Successful requests per minute since resetStats
+    uint32_t throughput(void);
+
+    // Send waiting requests on idle connections, called from ELClient::Process()
+    virtual void service(uint32_t now);
+
+    uint32_t completed; /**< Number of requests that got a 2xx response */
+    uint32_t errors;    /**< Number of requests that got any other response */
+    uint32_t timeouts;  /**< Number of requests that timed out */
+
+  private:
+    ELClient* _elc;                       /**< ELClient instance */
+    ELClientRest* _conn[REST_POOL_MAX];   /**< Connections */
+    ELClientRestRequest _slot[REST_POOL_MAX]; /**< Request in flight on each connection */
+    FP<void, void*> _userCb[REST_POOL_MAX];   /**< doneCb of the request in flight on each connection */
+    uint8_t _count;       /**< Number of connections */
+    uint8_t _active;      /**< Number of connections used for new requests */
+    uint32_t _timeout;    /**< Timeout for requests in milliseconds */
+    uint32_t _statsAt;    /**< millis() when the stats were reset */
+
+    ELClientRestRequest* _queue; /**< Waiting request slots, NULL if none */
+    uint8_t _qSize;       /**< Number of waiting request slots */
+    uint8_t _qHead;       /**< Slot of the oldest waiting request */
+    uint8_t _qCount;      /**< Number of waiting requests */
+
+    void dispatch(void);
+    void doneCallback(void* req);
+};
+
+#endif // _EL_CLIENT_REST_POOL_H_
@@ -8,6 +8,7 @@
 */
 
 #include "ELClientSocket.h"
+#include "ELClientStorage.h"
 
 /*! ELClientSocket(ELClient *e)
 @brief Class to send/receive data
@@ -25,12 +26,42 @@ ELClientSocket::ELClientSocket(ELClient *e)
 {
 	_elc = e;
 	remote_instance = -1;
+	_listeners = NULL;
+	_ctxCb = NULL;
+	_ctx = NULL;
+	_window = 0;
+	_inFlight = 0;
+	_sentAt = 0;
+	_sendTimeout = DEFAULT_SOCKET_TIMEOUT;
+	_txBuf = NULL;
+	_txSize = 0;
+	_txHead = 0;
+	_txCount = 0;
+	_txPackets = 0;
+	_coBuf = NULL;
+	_coSize = 0;
+	_coThreshold = 0;
+	_coDelay = 0;
+	_coLen = 0;
+	_coAt = 0;
+	memset(&_xfer, 0, sizeof(_xfer));
+	_xSource = NULL;
+	_xCtx = NULL;
+	_xChunk = SOCKET_CHUNK_SIZE;
+	_xLen = 0;
+	_xShort = false;
+	_clientStats = NULL;
+	_clientStatsCount = 0;
+	_slots = NULL;
+	_slotCount = 0;
+	_slotSeq = 0;
+	resetStats();
 }
 
 /*! socketCallback(void *res)
 @brief Callback function when data is sent, received or an error occured.
 @details The function is called when data is sent or received from the remote server.
-	If a user callback function (userCb) was defined it is called and the response is sent as an argument.
+	If a user callback function (userCb), a callback with context or eventCb was set it is called with the response.
 @note Internal library function
 @param res
 	Pointer to ELClientResponse structure
@@ -77,10 +108,38 @@ void ELClientSocket::socketCallback(void *res)
 		Serial.println("");
 	#endif
 	_status = 1;
+	countEvent();
+	if (_window != 0 && (_resp_type == USERCB_SENT || _resp_type == USERCB_RECO))
+	{
+		// an acknowledgement frees one credit, after a connection error no more will arrive
+		if (_resp_type == USERCB_RECO) _inFlight = 0;
+		else if (_inFlight > 0) _inFlight--;
+		_sentAt = millis();
+		drain();
+		if (_xfer.state == TRANSFER_RUNNING)
+		{
+			if (_resp_type == USERCB_RECO) transferEnd(TRANSFER_FAILED);
+			else transferStep();
+		}
+	}
+	for (ELClientSocketListener* l = _listeners; l != NULL; l = l->_nextListener)
+	{
+		l->socketEvent(_resp_type, _client_num, _len, _resp_type == USERCB_RECV ? _data : NULL);
+	}
 	if (_hasUserCb)
 	{
 		_userCb(_resp_type, _client_num, _len, _data);
 	}
+	if (_ctxCb != NULL)
+	{
+		_ctxCb(_ctx, _resp_type, _client_num, _len, _resp_type == USERCB_RECV ? _data : NULL);
+	}
+	if (eventCb.attached())
+	{
+		ELClientSocketEvent ev = { this, _resp_type, _client_num, _len, _resp_type == USERCB_RECV ? _data : NULL };
+		eventCb(&ev);
+	}
+	if (_slots != NULL && _resp_type == USERCB_RECV) keepPacket();
 }
 
 /*! begin(const char* host, uint16_t port, uint8_t sock_mode, void (*userCb)(uint8_t resp_type, uint8_t client_num, uint16_t len, char *data))
@@ -144,12 +203,54 @@ int ELClientSocket::begin(const char* host, uint16_t port, uint8_t sock_mode, vo
 	return (int)pkt->value;
 }
 
+/*! begin(const char* host, uint16_t port, uint8_t sock_mode, ELClientSocketCallback cb, void* ctx)
+@brief Initialize communication to a remote server with a callback that carries a context
+@details Same as begin with a plain callback, but cb is called with ctx as its first argument. With several
+	sockets each one can pass its owning object, so the callback doesn't have to find it through globals.
+	Alternatively attach a member function to <code>eventCb</code>.
+@param host
+	Host to be connected. Can be a URL or an IP address in the format of xxx.xxx.xxx.xxx .
+@param port
+	Port to be used to send/receive packets. Port MUST NOT be 80, 23 or 2323, as these ports are already used by EL-CLIENT on the ESP8266
+@param sock_mode
+	Set socket mode to SOCKET_TCP_CLIENT, SOCKET_TCP_CLIENT_LISTEN, SOCKET_TCP_SERVER or SOCKET_UDP
+@param cb
+	Callback, called with ctx, the response type, client number, length and received data
+@param ctx
+	Pointer passed to cb
+@return <code>int</code>
+	Connection number if the set-up was successful, a negative error code otherwise
+@par Example
+@code
+	class Sensor {
+		public:
+			static void onSocket(void* ctx, uint8_t resp_type, uint8_t client_num, uint16_t len, char *data) {
+				Sensor* self = (Sensor*)ctx;
+				if (resp_type == USERCB_RECV) self->handle(data, len);
+			}
+			void handle(char *data, uint16_t len);
+	};
+	Sensor sensor;
+	udp.begin(udpServer, udpPort, SOCKET_UDP, Sensor::onSocket, &sensor);
+@endcode
+*/
+int ELClientSocket::begin(const char* host, uint16_t port, uint8_t sock_mode, ELClientSocketCallback cb, void* ctx)
+{
+	_ctxCb = cb;
+	_ctx = ctx;
+	return begin(host, port, sock_mode);
+}
+
 /*! send(const char* data, int len)
 @brief Send data to the remote server.
+@details With a send window the data is queued if the window is full, see setSendWindow.
+	With write coalescing the data is collected with the data of following sends, see setCoalescing.
 @param data
 	Pointer to SOCKET packet
 @param len
 	Length of SOCKET packet
+@return <code>boolean</code>
+	True if the data was sent, queued or buffered, false if the socket is not set up or the send queue is full
 @par Example
 @code
 	Serial.println("Sending JSON array to SOCKET server");
@@ -157,33 +258,598 @@ int ELClientSocket::begin(const char* host, uint16_t port, uint8_t sock_mode, vo
 	socket.send(socketPacket, 39);
 @endcode
 */
-void ELClientSocket::send(const char* data, int len)
+boolean ELClientSocket::send(const char* data, int len)
 {
 	_status = 0;
-	if (remote_instance < 0) return;
-	_elc->Request(CMD_SOCKET_SEND, remote_instance, 2);
-	_elc->Request(data, strlen(data));
-	if (data != NULL && len > 0)
+	if (remote_instance < 0 || data == NULL || len <= 0) return false;
+	if (_coBuf == NULL) return post(data, len);
+
+	// make room in the coalescing buffer, data that doesn't fit into an empty buffer is sent as is
+	if (_coLen + len > _coSize && !flush()) return false;
+	if (len >= _coSize) return post(data, len);
+	if (_coLen == 0) _coAt = millis();
+	memcpy(_coBuf + _coLen, data, len);
+	_coLen += len;
+	if (_coLen >= _coThreshold) flush();
+	return true;
+}
+
+/*! post(const char* data, uint16_t len)
+@brief Send a packet through the send window
+@note Internal library function
+@param data
+	Data to send
+@param len
+	Length of the data
+@return <code>boolean</code>
+	False if the packet could not be queued
+*/
+boolean ELClientSocket::post(const char* data, uint16_t len)
+{
+	ELClientBlock block = { data, len, false };
+	return post(&block, 1, len);
+}
+
+/*! post(const ELClientBlock* iov, uint8_t count, uint16_t len)
+@brief Send a packet assembled from several blocks through the send window
+@details Sends the packet if there is a credit, otherwise copies it into the send queue.
+@note Internal library function
+@param iov
+	Blocks the packet consists of
+@param count
+	Number of blocks
+@param len
+	Total length of the blocks
+@return <code>boolean</code>
+	False if the packet could not be queued
+*/
+boolean ELClientSocket::post(const ELClientBlock* iov, uint8_t count, uint16_t len)
+{
+	if (_window == 0)
+	{
+		sendNow(iov, count, len);
+		return true;
+	}
+	if (_txPackets == 0 && _inFlight < _window)
 	{
-		_elc->Request(data, len);
+		sendNow(iov, count, len);
+		_inFlight++;
+		return true;
 	}
 
-	_elc->Request();
+	// queue the packet as 2-byte length followed by the data
+	if (_txBuf == NULL || (uint32_t)len + 2 > (uint32_t)(_txSize - _txCount))
+	{
+		stats.queueFull++;
+		return false;
+	}
+	uint16_t tail = _txHead + _txCount;
+	if (tail >= _txSize) tail -= _txSize;
+	_txBuf[tail] = len & 0xFF;
+	if (++tail == _txSize) tail = 0;
+	_txBuf[tail] = len >> 8;
+	if (++tail == _txSize) tail = 0;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		const uint8_t* p = (const uint8_t*)iov[i].data;
+		for (uint16_t j = 0; j < iov[i].len; j++)
+		{
+			_txBuf[tail] = iov[i].flash ? pgm_read_byte(p + j) : p[j];
+			if (++tail == _txSize) tail = 0;
+		}
+	}
+	_txCount += len + 2;
+	_txPackets++;
+	return true;
 }
 
 /*! send(const char* data)
 @brief Send null-terminated data to the remote server.
 @param data
 	Pointer to SOCKET packet, must be null-terminated
+@return <code>boolean</code>
+	True if the data was sent or queued, false if the socket is not set up or the send queue is full
 @par Example
 @code
 	Serial.println("Sending text message to SOCKET server");
 	socket.send("Message from your Arduino Uno WiFi over TCP socket");
 @endcode
 */
-void ELClientSocket::send(const char* data)
+boolean ELClientSocket::send(const char* data)
+{
+	return send(data, strlen(data));
+}
+
+/*! send(const ELClientBlock* iov, uint8_t count)
+@brief Send one packet assembled from several blocks
+@details The blocks are written to esp-link one after the other as a single packet, i.e., a single UDP
+	datagram, without copying them into a buffer first unless the packet has to be queued. Blocks may be
+	in RAM or in program memory. Data collected by write coalescing is sent first.
+@param iov
+	Blocks the packet consists of
+@param count
+	Number of blocks
+@return <code>boolean</code>
+	True if the packet was sent or queued, false if the socket is not set up or the send queue is full
+@par Example
+@code
+	struct { uint16_t seq; uint8_t count; } hdr = { seq++, SAMPLES };
+	ELClientBlock datagram[3] = {
+		{ &hdr, sizeof(hdr), false },
+		{ samples, sizeof(samples), false },
+		{ trailer, sizeof(trailer), true },   // PROGMEM
+	};
+	udp.send(datagram, 3);
+@endcode
+*/
+boolean ELClientSocket::send(const ELClientBlock* iov, uint8_t count)
+{
+	_status = 0;
+	uint32_t len = 0;
+	for (uint8_t i = 0; i < count; i++) len += iov[i].len;
+	if (remote_instance < 0 || len == 0 || len > 0xFFFF) return false;
+	if (!flush()) return false;
+	return post(iov, count, len);
+}
+
+/*! sendBatch(const ELClientBlock* datagrams, uint8_t count)
+@brief Send several datagrams in one request to esp-link
+@details Each block is sent as an argument of its own in a single CMD_SOCKET_SEND request, which saves
+	the framing of a request per datagram. This needs an esp-link version that sends each argument as a
+	datagram of its own, stock esp-link only sends the first one. With a send window each datagram
+	takes a credit, if there are not enough credits the datagrams are sent or queued one by one.
+@param datagrams
+	Datagrams to send, in RAM or program memory
+@param count
+	Number of datagrams
+@return <code>boolean</code>
+	True if all datagrams were sent or queued, false if the socket is not set up or the send queue is full
+*/
+boolean ELClientSocket::sendBatch(const ELClientBlock* datagrams, uint8_t count)
+{
+	_status = 0;
+	if (remote_instance < 0 || count == 0) return false;
+	if (!flush()) return false;
+	if (_window != 0 && (_txPackets != 0 || _inFlight + count > _window))
+	{
+		for (uint8_t i = 0; i < count; i++)
+		{
+			if (datagrams[i].len != 0 && !post(&datagrams[i], 1, datagrams[i].len)) return false;
+		}
+		return true;
+	}
+
+	uint32_t len = 0;
+	_elc->Request(CMD_SOCKET_SEND, remote_instance, count);
+	for (uint8_t i = 0; i < count; i++)
+	{
+		_elc->Request(ELClient::PrintBlock, (void*)&datagrams[i], datagrams[i].len);
+		len += datagrams[i].len;
+	}
+	_elc->Request();
+	_sentAt = millis();
+	countOut(len, count);
+	if (_window != 0) _inFlight += count;
+	return true;
+}
+
+// Blocks of a packet, the context of printBlocks
+typedef struct {
+	const ELClientBlock* iov;
+	uint8_t count;
+} BlockList;
+
+// Producer that prints one block of a BlockList per chunk
+static boolean printBlocks(Print* out, uint16_t chunk, void* ctx)
+{
+	BlockList* list = (BlockList*)ctx;
+	if (chunk >= list->count) return false;
+	ELClient::PrintBlock(out, 0, (void*)&list->iov[chunk]);
+	return chunk + 1 < list->count;
+}
+
+/*! sendNow(const ELClientBlock* iov, uint8_t count, uint16_t len)
+@brief Send a packet to esp-link
+@note Internal library function
+@param iov
+	Blocks the packet consists of
+@param count
+	Number of blocks
+@param len
+	Total length of the blocks
+*/
+void ELClientSocket::sendNow(const ELClientBlock* iov, uint8_t count, uint16_t len)
+{
+	_elc->Request(CMD_SOCKET_SEND, remote_instance, 1);
+	if (count == 1 && !iov->flash)
+	{
+		_elc->Request(iov->data, len);
+	}
+	else
+	{
+		BlockList list = { iov, count };
+		_elc->Request(printBlocks, &list, len);
+	}
+	_elc->Request();
+	_sentAt = millis();
+	countOut(len, 1);
+}
+
+/*! printQueued(Print* out, uint16_t chunk, void* ctx)
+@brief Producer that prints the oldest queued packet and removes it from the send queue
+@note Internal library function
+@param out
+	Print to send the data to
+@param chunk
+	Chunk number, the whole packet is printed as chunk 0
+@param ctx
+	Pointer to the ELClientSocket
+@return <code>boolean</code>
+	Always false, there are no more chunks
+*/
+boolean ELClientSocket::printQueued(Print* out, uint16_t, void* ctx)
+{
+	ELClientSocket* sock = (ELClientSocket*)ctx;
+	uint16_t pos = sock->_txHead;
+	uint16_t len = sock->_txBuf[pos];
+	if (++pos == sock->_txSize) pos = 0;
+	len |= sock->_txBuf[pos] << 8;
+	if (++pos == sock->_txSize) pos = 0;
+	for (uint16_t i = 0; i < len; i++)
+	{
+		out->write(sock->_txBuf[pos]);
+		if (++pos == sock->_txSize) pos = 0;
+	}
+	sock->_txHead = pos;
+	sock->_txCount -= len + 2;
+	sock->_txPackets--;
+	return false;
+}
+
+/*! sendQueued(void)
+@brief Send the oldest queued packet
+@note Internal library function
+*/
+void ELClientSocket::sendQueued(void)
+{
+	uint16_t pos = _txHead + 1;
+	if (pos == _txSize) pos = 0;
+	uint16_t len = _txBuf[_txHead] | (_txBuf[pos] << 8);
+	_elc->Request(CMD_SOCKET_SEND, remote_instance, 1);
+	_elc->Request(printQueued, this, len);
+	_elc->Request();
+	_sentAt = millis();
+	countOut(len, 1);
+	_inFlight++;
+}
+
+/*! drain(void)
+@brief Send queued packets while there are credits
+@note Internal library function
+*/
+void ELClientSocket::drain(void)
+{
+	while (_txPackets > 0 && _inFlight < _window)
+	{
+		sendQueued();
+	}
+}
+
+/*! setSendWindow(uint8_t window, uint8_t* buf, uint16_t size, uint32_t timeout)
+@brief Allow several sends to be in flight
+@details esp-link acknowledges each send with a USERCB_SENT callback. With a window of n up to n sends
+	may wait for their acknowledgement, further data is queued and sent as acknowledgements arrive.
+	This keeps the serial link busy during bulk uploads instead of waiting a round trip per send.
+	A connection error (USERCB_RECO) frees all credits. A running bulk transfer fails because its packets
+	in flight are forgotten.
+@param window
+	Maximum number of sends in flight, 0 sends everything immediately without tracking
+@param buf
+	(optional) Buffer for the send queue, without a queue send returns false when the window is full
+@param size
+	(optional) Size of the queue buffer, each packet takes its length plus 2 bytes
+@param timeout
+	(optional) Time in milliseconds after which unacknowledged sends free their credit, defaults to 5000ms
+@par Example
+@code
+	uint8_t txQueue[512];
+	socket.begin(socketServer, socketPort, SOCKET_TCP_CLIENT_LISTEN, socketCb);
+	socket.setSendWindow(4, txQueue, sizeof(txQueue));
+@endcode
+*/
+void ELClientSocket::setSendWindow(uint8_t window, uint8_t* buf, uint16_t size, uint32_t timeout)
+{
+	_window = window;
+	_txBuf = buf;
+	_txSize = buf != NULL ? size : 0;
+	_txHead = 0;
+	_txCount = 0;
+	_txPackets = 0;
+	_inFlight = 0;
+	_sendTimeout = timeout;
+	// the packets of a running transfer are no longer tracked
+	if (_xfer.state == TRANSFER_RUNNING) transferEnd(TRANSFER_FAILED);
+	if (_window != 0 || _coBuf != NULL) _elc->attachService(this);
+	else                                _elc->detachService(this);
+}
+
+/*! setCoalescing(uint8_t* buf, uint16_t size, uint16_t threshold, uint16_t delay)
+@brief Merge small sends into fewer packets
+@details Every packet sent to esp-link carries about 16 bytes of framing and each one becomes a
+	TCP segment or UDP datagram of its own. With write coalescing the data of consecutive sends is
+	collected in buf and sent as one packet once threshold bytes have been collected, delay
+	milliseconds after the first byte was buffered, or when flush is called.
+@warning For UDP each flush sends one datagram, so the data of several sends arrives together.
+@param buf
+	Buffer for the collected data, NULL turns coalescing off after sending what is buffered
+@param size
+	Size of the buffer, sends of this size or larger are sent as is
+@param threshold
+	(optional) Number of collected bytes that are sent right away, defaults to size
+@param delay
+	(optional) Time in milliseconds after which collected data is sent, defaults to 20ms
+@par Example
+@code
+	uint8_t txMerge[64];
+	socket.setCoalescing(txMerge, sizeof(txMerge));
+	socket.send("temp=");
+	socket.send(tempStr);
+	socket.send("\n");
+	socket.flush(); // optional, sent after 20ms anyway
+@endcode
+*/
+void ELClientSocket::setCoalescing(uint8_t* buf, uint16_t size, uint16_t threshold, uint16_t delay)
+{
+	flush();
+	_coBuf = buf;
+	_coSize = buf != NULL ? size : 0;
+	_coThreshold = threshold == 0 || threshold > _coSize ? _coSize : threshold;
+	_coDelay = delay;
+	_coLen = 0;
+	if (_window != 0 || _coBuf != NULL) _elc->attachService(this);
+	else                                _elc->detachService(this);
+}
+
+/*! flush(void)
+@brief Send the data collected by write coalescing
+@return <code>boolean</code>
+	False if the data could not be sent because the send queue is full, it stays buffered
+*/
+boolean ELClientSocket::flush(void)
+{
+	if (_coLen == 0) return true;
+	if (!post((const char*)_coBuf, _coLen)) return false;
+	_coLen = 0;
+	return true;
+}
+
+/*! credits(void)
+@brief Number of sends that go out immediately
+@return <code>uint8_t</code>
+	Free slots in the send window, 0 if the window is full or data is queued, 255 if there is no window
+*/
+uint8_t ELClientSocket::credits(void)
+{
+	if (_window == 0) return 255;
+	if (_txPackets > 0 || _inFlight >= _window) return 0;
+	return _window - _inFlight;
+}
+
+/*! service(uint32_t now)
+@brief Send coalesced data that is due and free the credits of sends that were not acknowledged in time
+@details Called from ELClient::Process() while a send window or write coalescing is set.
+@note Internal library function
+@param now
+	Current millis()
+*/
+void ELClientSocket::service(uint32_t now)
+{
+	if (_inFlight != 0 && now - _sentAt >= _sendTimeout)
+	{
+		_inFlight = 0;
+		// the packets whose credits were dropped may not have arrived
+		if (_xfer.state == TRANSFER_RUNNING) transferEnd(TRANSFER_FAILED);
+		drain();
+	}
+	if (_coLen != 0 && now - _coAt >= _coDelay) flush();
+	if (_xfer.state == TRANSFER_RUNNING) transferStep();
+}
+
+/*! startTransfer(ELClientSocketSource source, void* ctx, uint32_t total, uint16_t chunk)
+@brief Start a bulk transfer
+@details Sends total bytes read from source in packets of chunk bytes. The data is read piecewise while
+	each packet is sent, so no buffer for a whole packet is needed. The transfer keeps as many packets in
+	flight as the send window allows and continues from Process() as acknowledgements arrive, so a window
+	has to be set with setSendWindow first. A running CRC and the throughput are kept in the transfer status, which
+	is passed to transferCb after each packet and when the transfer ends. If a send is not acknowledged
+	within the timeout of the window the transfer fails.
+@param source
+	Function that reads the data, e.g. ReadBlock or ReadStorage
+@param ctx
+	Context pointer passed to the source
+@param total
+	Number of bytes to transfer
+@param chunk
+	(optional) Number of bytes per packet, defaults to SOCKET_CHUNK_SIZE
+@return <code>boolean</code>
+	False if the socket is not set up, has no send window or a transfer is already running
+@par Example
+@code
+	const char logo[] PROGMEM = { ... };
+	ELClientBlock logoBlock = { logo, sizeof(logo), true };
+
+	void transferCb(void* t) {
+		ELClientSocketTransfer* xfer = (ELClientSocketTransfer*)t;
+		if (xfer->state == TRANSFER_DONE) {
+			Serial.print("Sent "); Serial.print(xfer->sent);
+			Serial.print(" bytes at "); Serial.print(xfer->bytesPerSec);
+			Serial.print(" bytes/s, crc "); Serial.println(xfer->crc, HEX);
+		}
+	}
+
+	tcp.setSendWindow(4);
+	tcp.transferCb.attach(transferCb);
+	tcp.startTransfer(ELClientSocket::ReadBlock, &logoBlock, logoBlock.len);
+@endcode
+*/
+boolean ELClientSocket::startTransfer(ELClientSocketSource source, void* ctx, uint32_t total, uint16_t chunk)
+{
+	if (remote_instance < 0 || _window == 0 || _xfer.state == TRANSFER_RUNNING) return false;
+	flush();
+	memset(&_xfer, 0, sizeof(_xfer));
+	_xfer.state = TRANSFER_RUNNING;
+	_xfer.total = total;
+	_xfer.startedAt = millis();
+	_xSource = source;
+	_xCtx = ctx;
+	_xChunk = chunk != 0 ? chunk : SOCKET_CHUNK_SIZE;
+	_xShort = false;
+	transferStep();
+	return true;
+}
+
+/*! abortTransfer(void)
+@brief Stop the running bulk transfer
+@details Packets already sent are not recalled, the transfer ends as TRANSFER_FAILED.
+*/
+void ELClientSocket::abortTransfer(void)
 {
-	send(data, strlen(data));
+	if (_xfer.state == TRANSFER_RUNNING) transferEnd(TRANSFER_FAILED);
+}
+
+/*! printSource(Print* out, uint16_t chunk, void* ctx)
+@brief Producer that prints the next packet of a bulk transfer
+@details Reads the data from the source in small pieces and adds it to the CRC. If the source returns less
+	data than requested the rest of the packet is filled with zeros and the transfer fails.
+@note Internal library function
+@param out
+	Print to send the data to
+@param chunk
+	Chunk number, the whole packet is printed as chunk 0
+@param ctx
+	Pointer to the ELClientSocket
+@return <code>boolean</code>
+	Always false, there are no more chunks
+*/
+boolean ELClientSocket::printSource(Print* out, uint16_t, void* ctx)
+{
+	ELClientSocket* sock = (ELClientSocket*)ctx;
+	uint8_t buf[16];
+	uint32_t offset = sock->_xfer.sent;
+	for (uint16_t left = sock->_xLen; left > 0; )
+	{
+		uint16_t n = left < sizeof(buf) ? left : sizeof(buf);
+		uint16_t got = sock->_xShort ? 0 : sock->_xSource(buf, offset, n, sock->_xCtx);
+		if (got < n)
+		{
+			memset(buf + got, 0, n - got);
+			sock->_xShort = true;
+		}
+		sock->_xfer.crc = sock->_elc->crc16Data(buf, n, sock->_xfer.crc);
+		out->write(buf, n);
+		offset += n;
+		left -= n;
+	}
+	return false;
+}
+
+// Bytes per second for bytes sent in ms milliseconds, avoiding an overflow for large transfers
+static uint32_t rate(uint32_t bytes, uint32_t ms)
+{
+	if (ms == 0) ms = 1;
+	return bytes < 4000000UL ? bytes * 1000 / ms : bytes / ms * 1000;
+}
+
+/*! transferStep(void)
+@brief Send packets of the bulk transfer while there are credits and end it when all are acknowledged
+@note Internal library function
+*/
+void ELClientSocket::transferStep(void)
+{
+	while (_xfer.sent < _xfer.total && _txPackets == 0 && _inFlight < _window)
+	{
+		uint32_t left = _xfer.total - _xfer.sent;
+		_xLen = left < _xChunk ? left : _xChunk;
+		_elc->Request(CMD_SOCKET_SEND, remote_instance, 1);
+		_elc->Request(printSource, this, _xLen);
+		_elc->Request();
+		_sentAt = millis();
+		countOut(_xLen, 1);
+		_inFlight++;
+		_xfer.sent += _xLen;
+		if (_xShort)
+		{
+			transferEnd(TRANSFER_FAILED);
+			return;
+		}
+		_xfer.elapsed = millis() - _xfer.startedAt;
+		_xfer.bytesPerSec = rate(_xfer.sent, _xfer.elapsed);
+		if (transferCb.attached()) transferCb(&_xfer);
+	}
+	if (_xfer.sent == _xfer.total && _inFlight == 0) transferEnd(TRANSFER_DONE);
+}
+
+/*! transferEnd(uint8_t state)
+@brief End the bulk transfer and report it to transferCb
+@note Internal library function
+@param state
+	TRANSFER_DONE or TRANSFER_FAILED
+*/
+void ELClientSocket::transferEnd(uint8_t state)
+{
+	_xfer.state = state;
+	_xfer.elapsed = millis() - _xfer.startedAt;
+	_xfer.bytesPerSec = rate(_xfer.sent, _xfer.elapsed);
+	if (transferCb.attached()) transferCb(&_xfer);
+}
+
+/*! ReadBlock(uint8_t* buf, uint32_t offset, uint16_t len, void* ctx)
+@brief Transfer source that reads a block of data in RAM or program memory
+@param buf
+	Buffer for the data
+@param offset
+	Offset of the data in the block
+@param len
+	Number of bytes to read
+@param ctx
+	Pointer to an ELClientBlock
+@return <code>uint16_t</code>
+	Number of bytes read, less than len at the end of the block
+*/
+uint16_t ELClientSocket::ReadBlock(uint8_t* buf, uint32_t offset, uint16_t len, void* ctx)
+{
+	ELClientBlock* b = (ELClientBlock*)ctx;
+	if (offset >= b->len) return 0;
+	if (len > b->len - offset) len = b->len - offset;
+	const uint8_t* p = (const uint8_t*)b->data + offset;
+	if (b->flash) memcpy_P(buf, p, len);
+	else memcpy(buf, p, len);
+	return len;
+}
+
+/*! ReadStorage(uint8_t* buf, uint32_t offset, uint16_t len, void* ctx)
+@brief Transfer source that reads an ELClientStorage, e.g. a range of the EEPROM
+@param buf
+	Buffer for the data
+@param offset
+	Address of the data in the storage
+@param len
+	Number of bytes to read
+@param ctx
+	Pointer to an ELClientStorage
+@return <code>uint16_t</code>
+	Number of bytes read, less than len at the end of the storage
+*/
+uint16_t ELClientSocket::ReadStorage(uint8_t* buf, uint32_t offset, uint16_t len, void* ctx)
+{
+	ELClientStorage* st = (ELClientStorage*)ctx;
+	if (offset >= st->size()) return 0;
+	if (len > st->size() - offset) len = st->size() - offset;
+	for (uint16_t i = 0; i < len; i++)
+	{
+		buf[i] = st->read(offset + i);
+	}
+	return len;
 }
 
 /*! getResponse(uint8_t *resp_type, uint8_t *client_num, char* data, uint16_t maxLen)
@@ -316,3 +982,337 @@ uint16_t ELClientSocket::waitResponse(uint8_t *resp_type, uint8_t *client_num, c
 	}
 	return getResponse(resp_type, client_num, data, maxLen);
 }
+
+/*! attach(ELClientSocketListener* listener)
+@brief Attach a listener to the socket
+@details Listeners are called for every event of the socket, i.e., when data was sent or received,
+	on connection errors and on connect or disconnect, before the user callback is called.
+@note
+	This function is usually not needed for applications, library parts such as ELClientSocketStream attach themselves.
+@param listener
+	Listener to attach, attaching a listener that is already attached has no effect
+*/
+void ELClientSocket::attach(ELClientSocketListener* listener)
+{
+	for (ELClientSocketListener* l = _listeners; l != NULL; l = l->_nextListener)
+	{
+		if (l == listener) return;
+	}
+	listener->_nextListener = _listeners;
+	_listeners = listener;
+}
+
+/*! detach(ELClientSocketListener* listener)
+@brief Detach a listener from the socket
+@param listener
+	Listener to detach
+*/
+void ELClientSocket::detach(ELClientSocketListener* listener)
+{
+	ELClientSocketListener** link = &_listeners;
+	while (*link != NULL)
+	{
+		if (*link == listener)
+		{
+			*link = listener->_nextListener;
+			listener->_nextListener = NULL;
+			return;
+		}
+		link = &(*link)->_nextListener;
+	}
+}
+
+/*! setClientStats(ELClientSocketStats* table, uint8_t count)
+@brief Keep statistics per client number
+@details Entry i of the table counts the events of client number i, e.g. of the clients of a TCP server.
+	Bytes handed to esp-link can't be attributed to a client and are only counted in <code>stats</code>.
+@param table
+	Statistics entries, one per client number
+@param count
+	Number of entries, NULL or 0 turns per-client statistics off
+@par Example
+@code
+	ELClientSocketStats clientStats[4];
+	tcp.setClientStats(clientStats, 4);
+@endcode
+*/
+void ELClientSocket::setClientStats(ELClientSocketStats* table, uint8_t count)
+{
+	_clientStats = count > 0 ? table : NULL;
+	_clientStatsCount = _clientStats != NULL ? count : 0;
+	resetStats();
+}
+
+/*! resetStats(void)
+@brief Clear the statistics of the socket and of all clients
+*/
+void ELClientSocket::resetStats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+	stats.since = millis();
+	for (uint8_t i = 0; i < _clientStatsCount; i++)
+	{
+		memset(&_clientStats[i], 0, sizeof(ELClientSocketStats));
+		_clientStats[i].since = stats.since;
+	}
+}
+
+/*! snapshot(ELClientSocketStats* out, uint8_t client_num, boolean reset)
+@brief Copy the statistics of the socket or of one client
+@details With reset the counters start over after the copy, so consecutive snapshots give the traffic per
+	interval, e.g. to find the connection that saturates the link.
+@param out
+	Where to copy the statistics to
+@param client_num
+	(optional) Client number, SOCKET_ANY_CLIENT for the statistics of the whole socket (the default)
+@param reset
+	(optional) Clear the copied counters, defaults to false
+@return <code>boolean</code>
+	False if there are no statistics for the client number
+*/
+boolean ELClientSocket::snapshot(ELClientSocketStats* out, uint8_t client_num, boolean reset)
+{
+	ELClientSocketStats* st = &stats;
+	if (client_num != SOCKET_ANY_CLIENT)
+	{
+		if (client_num >= _clientStatsCount) return false;
+		st = &_clientStats[client_num];
+	}
+	*out = *st;
+	if (reset)
+	{
+		memset(st, 0, sizeof(ELClientSocketStats));
+		st->since = millis();
+	}
+	return true;
+}
+
+/*! printStats(Print* out, uint16_t chunk, void* ctx)
+@brief Producer that prints the statistics of a socket as JSON
+@details Prints an object with the socket statistics and an array with those of each client, e.g.
+	{"out":1200,"sent":1200,"recv":64,"pkts":[12,2],"errors":0,"last":0,"conns":[1,0],"full":0,"overrun":0,"ms":5000,"clients":[...]}
+@param out
+	Print to output to
+@param chunk
+	Chunk number, unused
+@param ctx
+	Pointer to the ELClientSocket
+@return <code>boolean</code>
+	False, all statistics are printed in one go
+@par Example
+@code
+	mqtt.publish("/stats/tcp", &ELClientSocket::printStats, &tcp);
+@endcode
+*/
+boolean ELClientSocket::printStats(Print* out, uint16_t, void* ctx)
+{
+	ELClientSocket* sock = (ELClientSocket*)ctx;
+	uint32_t now = millis();
+	for (int e = -1; e < sock->_clientStatsCount; e++)
+	{
+		ELClientSocketStats* st = e < 0 ? &sock->stats : &sock->_clientStats[e];
+		if (e == 0) out->print(F(",\"clients\":["));
+		else if (e > 0) out->write(',');
+		out->print(F("{\"out\":"));
+		out->print(st->bytesOut);
+		out->print(F(",\"sent\":"));
+		out->print(st->bytesSent);
+		out->print(F(",\"recv\":"));
+		out->print(st->bytesRecv);
+		out->print(F(",\"pkts\":["));
+		out->print(st->packetsSent);
+		out->write(',');
+		out->print(st->packetsRecv);
+		out->print(F("],\"errors\":"));
+		out->print(st->errors);
+		out->print(F(",\"last\":"));
+		out->print(st->lastError);
+		out->print(F(",\"conns\":["));
+		out->print(st->connects);
+		out->write(',');
+		out->print(st->disconnects);
+		out->print(F("],\"full\":"));
+		out->print(st->queueFull);
+		out->print(F(",\"overrun\":"));
+		out->print(st->rxOverrun);
+		out->print(F(",\"ms\":"));
+		out->print(now - st->since);
+		if (e >= 0) out->write('}');
+	}
+	if (sock->_clientStatsCount > 0) out->write(']');
+	out->write('}');
+	return false;
+}
+
+/*! countOut(uint32_t len, uint8_t packets)
+@brief Count data handed to esp-link
+@note Internal library function
+@param len
+	Number of bytes
+@param packets
+	Number of packets
+*/
+void ELClientSocket::countOut(uint32_t len, uint8_t packets)
+{
+	stats.bytesOut += len;
+	stats.packetsSent += packets;
+}
+
+/*! countEvent(void)
+@brief Count the event just received in the statistics of the socket and of its client
+@note Internal library function
+*/
+void ELClientSocket::countEvent(void)
+{
+	ELClientSocketStats* st[2] = { &stats, _client_num < _clientStatsCount ? &_clientStats[_client_num] : NULL };
+	for (uint8_t i = 0; i < 2 && st[i] != NULL; i++)
+	{
+		switch (_resp_type)
+		{
+		case USERCB_SENT:
+			st[i]->bytesSent += _len;
+			break;
+		case USERCB_RECV:
+			st[i]->bytesRecv += _len;
+			st[i]->packetsRecv++;
+			break;
+		case USERCB_RECO:
+			st[i]->errors++;
+			st[i]->lastError = (int16_t)_len;
+			break;
+		case USERCB_CONN:
+			if (_len != 0) st[i]->connects++;
+			else st[i]->disconnects++;
+			break;
+		}
+	}
+}
+
+/*! setReceivePool(ELClientSocketSlot* slots, uint8_t* bufs, uint8_t count)
+@brief Keep received packets without copying them
+@details Normally the received data is only valid during the callback because the next packet is received
+	into the same buffer. With a receive pool the buffer holding a received packet is kept in a slot and
+	ELClient continues receiving into the spare buffer of a free slot, so the packet is never copied.
+	The sketch borrows packets with receive() and hands them back with release() when it is done, which
+	may be much later. While all slots hold packets, further packets are only passed to the callback and
+	counted in <code>stats.rxOverrun</code>. Calling it again, or with count 0 to turn the pool off, gives
+	ELClient its own buffer back and hands all of bufs back to the sketch, so packets still kept or borrowed
+	from the old pool are lost. Don't call it from a socket callback.
+	Only one socket of an ELClient can have a receive pool: the buffers circulate through ELClient, so
+	a slot of one pool could end up holding a buffer of the other and the pools couldn't be taken back
+	separately. Turn off the pool of one socket before setting one up on another.
+@param slots
+	Slots of the pool
+@param bufs
+	Buffers for the slots, count * ESP_BUFSIZE bytes
+@param count
+	Number of slots
+@return <code>boolean</code>
+	False if another socket of the ELClient has a receive pool and count isn't 0, nothing is changed then
+@par Example
+@code
+	ELClientSocketSlot rxSlots[3];
+	uint8_t rxBufs[3 * ESP_BUFSIZE];
+
+	void setup()
+	{
+		...
+		udp.setReceivePool(rxSlots, rxBufs, 3);
+	}
+
+	void loop()
+	{
+		esp.Process();
+		ELClientSocketSlot* pkt = udp.receive();
+		if (pkt != NULL)
+		{
+			decode(pkt->data, pkt->len); // may take a while, more packets are received meanwhile
+			udp.release(pkt);
+		}
+	}
+@endcode
+*/
+boolean ELClientSocket::setReceivePool(ELClientSocketSlot* slots, uint8_t* bufs, uint8_t count)
+{
+	// while another socket has the pool this one has none, so there is nothing to turn off
+	if (_elc->_swapOwner != NULL && _elc->_swapOwner != this) return count == 0;
+	// ELClient may be receiving into one of the old buffers while a slot holds its own one
+	if (_slots != NULL) _elc->swapBuffer(NULL);
+	_slots = count > 0 ? slots : NULL;
+	_slotCount = _slots != NULL ? count : 0;
+	_elc->_swapOwner = _slots != NULL ? this : NULL;
+	for (uint8_t i = 0; i < _slotCount; i++)
+	{
+		memset(&_slots[i], 0, sizeof(ELClientSocketSlot));
+		_slots[i].buf = bufs + i * ESP_BUFSIZE;
+	}
+	return true;
+}
+
+/*! keepPacket(void)
+@brief Keep the packet just received in a free slot of the receive pool
+@details Exchanges the buffer holding the packet with the spare buffer of a free slot.
+@note Internal library function
+*/
+void ELClientSocket::keepPacket(void)
+{
+	for (uint8_t i = 0; i < _slotCount; i++)
+	{
+		ELClientSocketSlot* slot = &_slots[i];
+		if (slot->state != SLOT_FREE) continue;
+		slot->buf = _elc->swapBuffer(slot->buf);
+		slot->data = _data;
+		slot->len = _len;
+		slot->client_num = _client_num;
+		slot->seq = _slotSeq++;
+		slot->state = SLOT_READY;
+		return;
+	}
+	stats.rxOverrun++;
+}
+
+/*! receive(void)
+@brief Borrow the oldest received packet from the receive pool
+@return <code>ELClientSocketSlot*</code>
+	Slot with the packet, NULL if no packet is waiting. The data stays valid until the slot is released.
+*/
+ELClientSocketSlot* ELClientSocket::receive(void)
+{
+	ELClientSocketSlot* oldest = NULL;
+	for (uint8_t i = 0; i < _slotCount; i++)
+	{
+		ELClientSocketSlot* slot = &_slots[i];
+		if (slot->state == SLOT_READY && (oldest == NULL || (int16_t)(slot->seq - oldest->seq) < 0))
+		{
+			oldest = slot;
+		}
+	}
+	if (oldest != NULL) oldest->state = SLOT_LENT;
+	return oldest;
+}
+
+/*! release(ELClientSocketSlot* slot)
+@brief Hand a borrowed slot back to the receive pool
+@details The buffer of the slot is reused for a later packet, the data must not be used anymore.
+@param slot
+	Slot returned by receive()
+*/
+void ELClientSocket::release(ELClientSocketSlot* slot)
+{
+	if (slot != NULL) slot->state = SLOT_FREE;
+}
+
+/*! pending(void)
+@brief Number of received packets waiting in the receive pool
+@return <code>uint8_t</code>
+	Number of packets that receive() can hand out
+*/
+uint8_t ELClientSocket::pending(void)
+{
+	uint8_t n = 0;
+	for (uint8_t i = 0; i < _slotCount; i++)
+	{
+		if (_slots[i].state == SLOT_READY) n++;
+	}
+	return n;
+}
@@ -30,6 +30,95 @@
 // Enable/disable debug output. If defined enables the debug output on Serial port
 //#define DEBUG_EN /**< Enable/disable debug output */
 
+#define SOCKET_ANY_CLIENT 0xFF /**< Client number that matches all connections of a socket */
+
+// ELClientSocketListener is the base class for the library parts that consume the events of a
+// socket, e.g. ELClientSocketStream. Attached listeners see every event before the user callback.
+class ELClientSocketListener {
+	public:
+		ELClientSocketListener() : _nextListener(0) {}
+		// Handle an event, data points to the received bytes for USERCB_RECV and is NULL otherwise.
+		// The data is only valid during the call.
+		virtual void socketEvent(uint8_t resp_type, uint8_t client_num, uint16_t len, char *data) = 0;
+
+		ELClientSocketListener* _nextListener; /**< Next attached listener */
+};
+
+class ELClientSocket;
+
+// Event of a socket, passed to ELClientSocket::eventCb
+typedef struct {
+	ELClientSocket* socket; /**< Socket the event belongs to */
+	uint8_t resp_type;      /**< USERCB_SENT, USERCB_RECV, USERCB_RECO or USERCB_CONN */
+	uint8_t client_num;     /**< Connection number */
+	uint16_t len;           /**< Size of the received packet, number of sent bytes, error code or connection state */
+	char *data;             /**< Received packet for USERCB_RECV, NULL otherwise */
+} ELClientSocketEvent;
+
+// Socket callback that gets the context pointer passed to ELClientSocket::begin
+typedef void (*ELClientSocketCallback)(void* ctx, uint8_t resp_type, uint8_t client_num, uint16_t len, char *data);
+
+#define SOCKET_CHUNK_SIZE 64 /**< Default number of bytes a bulk transfer sends per packet */
+
+// A source provides the data of a bulk transfer, it reads len bytes starting at offset into buf and
+// returns the number of bytes read. ELClientSocket::ReadBlock and ReadStorage read RAM, program
+// memory and EEPROM.
+typedef uint16_t (*ELClientSocketSource)(uint8_t* buf, uint32_t offset, uint16_t len, void* ctx);
+
+// State of a bulk transfer
+typedef enum {
+	TRANSFER_IDLE = 0, /**< No transfer was started */
+	TRANSFER_RUNNING,  /**< Data is being sent */
+	TRANSFER_DONE,     /**< All data was sent and acknowledged */
+	TRANSFER_FAILED,   /**< Aborted, the source ran short or the connection failed */
+} TRANSFER_STATE;
+
+// Progress of a bulk transfer, passed to ELClientSocket::transferCb
+typedef struct {
+	uint8_t state;        /**< TRANSFER_STATE */
+	uint32_t total;       /**< Number of bytes to transfer */
+	uint32_t sent;        /**< Number of bytes sent so far */
+	uint16_t crc;         /**< CRC-16/KERMIT of the bytes sent so far, the CRC of the framing */
+	uint32_t startedAt;   /**< millis() when the transfer started */
+	uint32_t elapsed;     /**< Milliseconds since the start, up to the end of the transfer */
+	uint32_t bytesPerSec; /**< Throughput in bytes per second */
+} ELClientSocketTransfer;
+
+// Traffic and error counters of a socket or of one of its clients, see ELClientSocket::snapshot
+typedef struct {
+	uint32_t bytesOut;    /**< Bytes handed to esp-link, counted per socket only */
+	uint32_t bytesSent;   /**< Bytes esp-link reported as sent with USERCB_SENT */
+	uint32_t bytesRecv;   /**< Bytes received */
+	uint16_t packetsSent; /**< Packets handed to esp-link, counted per socket only */
+	uint16_t packetsRecv; /**< Packets received */
+	uint16_t errors;      /**< Number of connection errors (USERCB_RECO) */
+	int16_t lastError;    /**< Code of the last connection error */
+	uint16_t connects;    /**< Number of connect events, more than one means reconnects */
+	uint16_t disconnects; /**< Number of disconnect events */
+	uint16_t queueFull;   /**< Sends rejected because the send queue was full, counted per socket only */
+	uint16_t rxOverrun;   /**< Packets not kept because all receive slots were in use, counted per socket only */
+	uint32_t since;       /**< millis() when the counters were reset */
+} ELClientSocketStats;
+
+// State of a receive slot
+typedef enum {
+	SLOT_FREE = 0, /**< The buffer of the slot is spare */
+	SLOT_READY,    /**< The slot holds a received packet */
+	SLOT_LENT,     /**< The packet was handed out by receive() and is not yet released */
+} SLOT_STATE;
+
+// A received packet kept in the receive pool, see ELClientSocket::setReceivePool
+typedef struct {
+	uint8_t* buf;       /**< Buffer of the slot, changes as buffers circulate */
+	char *data;         /**< Received data, points into buf */
+	uint16_t len;       /**< Length of the received data */
+	uint8_t client_num; /**< Connection the data was received on */
+	uint8_t state;      /**< SLOT_STATE */
+	uint16_t seq;       /**< Arrival order */
+} ELClientSocketSlot;
+
+class ELClientStorage;
+
 // The ELClientSocket class sends data over a simple Socket connection to a remote server. Each instance
 // is used to communicate with one server and multiple instances can be created to send
 // to multiple servers.
@@ -37,7 +126,13 @@
 // only a single response can be recevied at a time and the responses of the two requests
 // may arrive out of order.
 // A major limitation of the Socket class is that it does not wait for the response data. 
-class ELClientSocket {
+//
+// Sends are acknowledged by esp-link with USERCB_SENT. Without a send window each send goes out
+// immediately. With setSendWindow several sends may be in flight and sends beyond the window are
+// queued and go out as acknowledgements arrive, so bulk uploads are not limited to one send per
+// round trip. With setCoalescing the data of small sends is merged into fewer, larger packets.
+// startTransfer streams a large block of data from RAM, program memory or EEPROM within the window.
+class ELClientSocket : public ELClientService {
 	public:
 		ELClientSocket(ELClient *e);
 
@@ -51,11 +146,79 @@ class ELClientSocket {
 		// after data was received or when an error occured. See example code port how to use it.
 		int begin(const char* host, uint16_t port, uint8_t sock_mode, void (*userCb)(uint8_t resp_type, uint8_t client_num, uint16_t len, char *data)=0);
 
-		// Send data to the remote server. The data must be null-terminated
-		void send(const char* data);
+		// Initialize communication to a remote server like above, the callback is called with ctx as
+		// its first argument so it can go straight to the object that owns the socket
+		int begin(const char* host, uint16_t port, uint8_t sock_mode, ELClientSocketCallback cb, void* ctx);
+
+		// Send data to the remote server. The data must be null-terminated. Returns false if the
+		// data was neither sent nor queued
+		boolean send(const char* data);
+
+		// Send data to the remote server. Returns false if the data was neither sent nor queued
+		boolean send(const char* data, int len);
+
+		// Send one packet, e.g. one UDP datagram, assembled from count blocks in RAM or program memory
+		// without copying them into a buffer first
+		boolean send(const ELClientBlock* iov, uint8_t count);
+
+		// Send count datagrams in a single request to esp-link, needs esp-link support for several
+		// datagrams per request
+		boolean sendBatch(const ELClientBlock* datagrams, uint8_t count);
+
+		// Allow up to window sends to wait for USERCB_SENT at a time. Data sent while the window is
+		// full is queued in the size bytes at buf, sends that are not acknowledged within timeout
+		// milliseconds free their credit. A window of 0 sends everything immediately (the default).
+		void setSendWindow(uint8_t window, uint8_t* buf=NULL, uint16_t size=0, uint32_t timeout=DEFAULT_SOCKET_TIMEOUT);
+		// Number of sends that can be made before data gets queued, 255 if there is no window
+		uint8_t credits(void);
+		// Number of sends waiting for USERCB_SENT
+		uint8_t inFlight(void) { return _inFlight; }
+		// Number of packets waiting in the send queue
+		uint8_t queued(void) { return _txPackets; }
+
+		// Collect the data of small sends in the size bytes at buf and send it as one packet once
+		// threshold bytes are collected or delay milliseconds after the first one. NULL turns it off.
+		void setCoalescing(uint8_t* buf, uint16_t size, uint16_t threshold=0, uint16_t delay=20);
+		// Send the collected data now, returns false if the send queue is full
+		boolean flush(void);
+		// Number of bytes collected and not yet sent
+		uint16_t buffered(void) { return _coLen; }
 
-		// Send data to the remote server.
-		void send(const char* data, int len);
+		// Send total bytes read from source in packets of chunk bytes, keeping as many packets in
+		// flight as the send window allows. Progress is reported to transferCb. Returns false if
+		// the socket is not set up, has no send window or a transfer is running.
+		boolean startTransfer(ELClientSocketSource source, void* ctx, uint32_t total, uint16_t chunk=SOCKET_CHUNK_SIZE);
+		// Stop the running transfer, it ends as TRANSFER_FAILED
+		void abortTransfer(void);
+		// Progress of the running or last transfer
+		const ELClientSocketTransfer* transferStatus(void) { return &_xfer; }
+		// Source that reads an ELClientBlock in RAM or program memory
+		static uint16_t ReadBlock(uint8_t* buf, uint32_t offset, uint16_t len, void* ctx);
+		// Source that reads an ELClientStorage, e.g. the EEPROM
+		static uint16_t ReadStorage(uint8_t* buf, uint32_t offset, uint16_t len, void* ctx);
+
+		// Count the traffic of each client number in table[client_num], count is the size of the table
+		void setClientStats(ELClientSocketStats* table, uint8_t count);
+		// Clear the counters of the socket and of all clients
+		void resetStats(void);
+		// Copy the counters of client client_num, or of the socket for SOCKET_ANY_CLIENT, to out and
+		// optionally clear them. Returns false if there are no counters for the client.
+		boolean snapshot(ELClientSocketStats* out, uint8_t client_num=SOCKET_ANY_CLIENT, boolean reset=false);
+		// Producer that prints the counters of the ELClientSocket passed as ctx as JSON
+		static boolean printStats(Print* out, uint16_t chunk, void* ctx);
+
+		// Keep received packets in count slots instead of only passing them to the callback. bufs
+		// provides count * ESP_BUFSIZE bytes, the packets are received straight into these buffers.
+		// Setting it up again or with count 0 takes back the buffers and drops the kept packets.
+		// Only one socket per ELClient can have a receive pool, returns false if another one has.
+		boolean setReceivePool(ELClientSocketSlot* slots, uint8_t* bufs, uint8_t count);
+		// Borrow the oldest received packet, returns NULL if there is none. Its data stays valid
+		// until the slot is released.
+		ELClientSocketSlot* receive(void);
+		// Return a borrowed slot to the pool
+		void release(ELClientSocketSlot* slot);
+		// Number of received packets waiting to be borrowed
+		uint8_t pending(void);
 
 		// Retrieve the response from the remote server, returns the number of send or received bytes, 0 if no
 		// response (may need to wait longer)
@@ -68,8 +231,22 @@ class ELClientSocket {
 		// Blocks the Arduino code for 5 seconds! not recommended to use. See code examples how to use the callback function instead
 		uint16_t waitResponse(uint8_t *resp_type, uint8_t *client_num, char* data, uint16_t maxLen, uint32_t timeout=DEFAULT_SOCKET_TIMEOUT);
 
+		// Attach a listener that gets all events of this socket, attaching a listener twice has no effect
+		void attach(ELClientSocketListener* listener);
+		// Detach a previously attached listener
+		void detach(ELClientSocketListener* listener);
+
+		// Send coalesced data and free the credits of sends that timed out, called from ELClient::Process()
+		virtual void service(uint32_t now);
+
 		int32_t remote_instance; /**< Connection number, value can be 0 to 3 */
 
+		// Callback for all events of the socket, e.g. bound to a member function with
+		// eventCb.attach(this, &MyClass::onSocket). It is called with an ELClientSocketEvent pointer.
+		FP<void, void*> eventCb; /**< Called with an ELClientSocketEvent for each event */
+		FP<void, void*> transferCb; /**< Called with an ELClientSocketTransfer after each packet and at the end of a transfer */
+		ELClientSocketStats stats; /**< Counters of the whole socket */
+
 	private:
 		ELClient *_elc; /**< ELClient instance */
 		void socketCallback(void* resp);
@@ -140,10 +317,53 @@ class ELClientSocket {
 		_userCallback _userCb; /**< Pointer to internal callback function */
 
 		bool _hasUserCb = false; /**< Flag for user callback, true if user callback has been set */
+		ELClientSocketCallback _ctxCb; /**< Callback with context, NULL if none */
+		void* _ctx; /**< Context passed to _ctxCb */
 		int16_t _status; /**< Connection status */
 		uint16_t _len; /**< Number of sent/received bytes */
 		char *_data; /**< Buffer for received data */
 		uint8_t _resp_type; /**< Response type: 0 = send, 1 = receive; 2 = reset connection, 3 = connection */
 		uint8_t _client_num; /**< Connection number, value can be 0 to 3 */
+		ELClientSocketListener* _listeners; /**< List of attached listeners */
+
+		uint8_t _window;     /**< Maximum number of sends in flight, 0 if unlimited */
+		uint8_t _inFlight;   /**< Number of sends waiting for USERCB_SENT */
+		uint32_t _sentAt;    /**< millis() of the last send or acknowledgement */
+		uint32_t _sendTimeout; /**< Time after which unacknowledged sends free their credit */
+		uint8_t* _txBuf;     /**< Send queue, packets are stored as 2-byte length and data */
+		uint16_t _txSize;    /**< Size of the send queue */
+		uint16_t _txHead;    /**< Position of the oldest queued byte */
+		uint16_t _txCount;   /**< Number of queued bytes */
+		uint8_t _txPackets;  /**< Number of queued packets */
+		uint8_t* _coBuf;     /**< Buffer for coalesced writes, NULL if off */
+		uint16_t _coSize;    /**< Size of the coalescing buffer */
+		uint16_t _coThreshold; /**< Number of collected bytes that are sent right away */
+		uint16_t _coDelay;   /**< Time after which collected bytes are sent */
+		uint16_t _coLen;     /**< Number of collected bytes */
+		uint32_t _coAt;      /**< millis() when the first collected byte was buffered */
+		ELClientSocketTransfer _xfer; /**< Progress of the bulk transfer */
+		ELClientSocketSource _xSource; /**< Source of the bulk transfer */
+		void* _xCtx;         /**< Context passed to the source */
+		uint16_t _xChunk;    /**< Bytes per packet of the bulk transfer */
+		uint16_t _xLen;      /**< Bytes in the packet being sent */
+		boolean _xShort;     /**< The source returned less data than requested */
+		ELClientSocketStats* _clientStats; /**< Counters per client number, NULL if none */
+		uint8_t _clientStatsCount; /**< Number of entries in _clientStats */
+		ELClientSocketSlot* _slots; /**< Receive pool, NULL if none */
+		uint8_t _slotCount;  /**< Number of receive slots */
+		uint16_t _slotSeq;   /**< Arrival number of the next received packet */
+
+		boolean post(const char* data, uint16_t len);
+		boolean post(const ELClientBlock* iov, uint8_t count, uint16_t len);
+		void sendNow(const ELClientBlock* iov, uint8_t count, uint16_t len);
+		void sendQueued(void);
+		void drain(void);
+		static boolean printQueued(Print* out, uint16_t chunk, void* ctx);
+		static boolean printSource(Print* out, uint16_t chunk, void* ctx);
+		void transferStep(void);
+		void transferEnd(uint8_t state);
+		void countOut(uint32_t len, uint8_t packets);
+		void countEvent(void);
+		void keepPacket(void);
 };
 #endif // _EL_CLIENT_SOCKET_H_
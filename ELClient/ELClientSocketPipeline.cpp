@@ -0,0 +1,332 @@
+/*! \file ELClientSocketPipeline.cpp
+	\brief Constructor and functions for ELClientSocketPipeline
+*/
+#include "ELClientSocketPipeline.h"
+
+/*! ELClientSocketPipeline(ELClient* e, ELClientSocket* sock, ELClientSocketTxn* slots, uint8_t count, uint8_t* buf, uint16_t size)
+@brief Create a transaction pipeline on a TCP client socket
+@details The pipeline attaches itself to the socket and to ELClient::Process() for the timeouts, the user
+	callback of the socket still gets all events. Set up a send window on the socket to keep more than
+	one request in flight.
+@param e
+	Pointer to ELClient
+@param sock
+	Pointer to the socket, it is set up with begin and SOCKET_TCP_CLIENT_LISTEN as usual
+@param slots
+	Array of transactions, the maximum number of pending requests
+@param count
+	Number of entries in slots
+@param buf
+	Buffer the responses are assembled in
+@param size
+	Size of the buffer, must hold the longest response
+@par Example
+@code
+	ELClientSocket tcp(&esp);
+	ELClientSocketTxn txns[4];
+	uint8_t rxBuf[128];
+	ELClientSocketPipeline pipe(&esp, &tcp, txns, 4, rxBuf, sizeof(rxBuf));
+
+	void setup()
+	{
+		...
+		tcp.begin(tcpServer, tcpPort, SOCKET_TCP_CLIENT_LISTEN);
+		tcp.setSendWindow(4);
+		pipe.setFramer(ELClientSocketPipeline::FrameLine);
+	}
+@endcode
+*/
+ELClientSocketPipeline::ELClientSocketPipeline(ELClient* e, ELClientSocket* sock, ELClientSocketTxn* slots, uint8_t count, uint8_t* buf, uint16_t size)
+{
+	_sock = sock;
+	_slots = slots;
+	_size = count;
+	_head = 0;
+	_count = 0;
+	_buf = buf;
+	_bufSize = size;
+	_len = 0;
+	_framer = FrameLine;
+	_framerCtx = NULL;
+	_timeout = DEFAULT_SOCKET_TIMEOUT;
+	_inCallback = false;
+	_deferred = TXN_PENDING;
+	completed = 0;
+	failed = 0;
+	stray = 0;
+	_sock->attach(this);
+	e->attachService(this);
+}
+
+/*! setFramer(ELClientFramer framer, void* ctx)
+@brief Set the function that splits the received bytes into responses
+@details The framer is called with all bytes received since the last complete response each time data
+	arrives, and again after each response it found.
+@param framer
+	Framer, e.g. FrameLine or FrameLength
+@param ctx
+	(optional) Passed to the framer, e.g. the delimiter of a custom framer
+@par Example
+@code
+	// Responses are a 3-byte header followed by the number of bytes in header[2]
+	uint16_t frameRecord(const uint8_t* buf, uint16_t len, void* ctx)
+	{
+		if (len < 3 || len < 3 + buf[2]) return 0;
+		return 3 + buf[2];
+	}
+
+	pipe.setFramer(frameRecord);
+@endcode
+*/
+void ELClientSocketPipeline::setFramer(ELClientFramer framer, void* ctx)
+{
+	_framer = framer;
+	_framerCtx = ctx;
+}
+
+/*! request(const char* data)
+@brief Send a request
+@param data
+	Null-terminated request including its framing, e.g. the trailing newline
+@return <code>ELClientSocketTxn*</code>
+	Transaction of the request, NULL if all slots are pending or the socket could not take the data
+*/
+ELClientSocketTxn* ELClientSocketPipeline::request(const char* data)
+{
+	return request(data, strlen(data));
+}
+
+/*! request(const char* data, uint16_t len)
+@brief Send a request
+@details The request is sent without waiting for the responses to earlier ones, or queued by the send
+	window of the socket, so the data need not stay valid. The doneCb of the returned transaction is
+	detached and its timeout is the one set with setTimeout, both can be changed before the next call
+	to ELClient::Process. doneCb is called once the response arrived or the transaction failed, the
+	response is in the receive buffer and only valid until doneCb returns. Requests made from a
+	doneCb fail while all slots are pending, because the slot is freed after doneCb returns.
+@param data
+	Request including its framing
+@param len
+	Length of the request
+@return <code>ELClientSocketTxn*</code>
+	Transaction of the request, NULL if all slots are pending or the socket could not take the data
+@par Example
+@code
+	void onReading(void* t)
+	{
+		ELClientSocketTxn* txn = (ELClientSocketTxn*)t;
+		if (txn->status == TXN_OK) Serial.write(txn->resp, txn->respLen);
+	}
+
+	void loop()
+	{
+		esp.Process();
+		if (pipe.pending() == 0)
+		{
+			for (uint8_t i = 0; i < 4; i++)
+			{
+				ELClientSocketTxn* txn = pipe.request(query[i]);
+				if (txn != NULL) txn->doneCb.attach(onReading);
+			}
+		}
+	}
+@endcode
+*/
+ELClientSocketTxn* ELClientSocketPipeline::request(const char* data, uint16_t len)
+{
+	if (_count == _size) return NULL;
+	if (!_sock->send(data, len)) return NULL;
+
+	ELClientSocketTxn* txn = &_slots[(_head + _count) % _size];
+	txn->doneCb.detach();
+	txn->ctx = NULL;
+	txn->status = TXN_PENDING;
+	txn->resp = NULL;
+	txn->respLen = 0;
+	txn->timeout = _timeout;
+	txn->sentAt = millis();
+	txn->doneAt = 0;
+	_count++;
+	return txn;
+}
+
+/*! cancel(void)
+@brief Fail all pending transactions
+@details doneCb is called with TXN_FAILED for each of them and the received bytes are discarded. Responses
+	to these requests that arrive later are taken for the responses of new requests, so close the
+	connection or wait for them to be counted in <code>stray</code> before making new requests.
+*/
+void ELClientSocketPipeline::cancel(void)
+{
+	failAll(TXN_FAILED);
+}
+
+/*! FrameLine(const uint8_t* buf, uint16_t len, void* ctx)
+@brief Framer for line-oriented protocols
+@param buf
+	Received bytes
+@param len
+	Number of received bytes
+@param ctx
+	Unused
+@return <code>uint16_t</code>
+	Length of the first line including its newline, 0 if there is no complete line
+*/
+uint16_t ELClientSocketPipeline::FrameLine(const uint8_t* buf, uint16_t len, void*)
+{
+	const uint8_t* nl = (const uint8_t*)memchr(buf, '\n', len);
+	return nl != NULL ? nl - buf + 1 : 0;
+}
+
+/*! FrameLength(const uint8_t* buf, uint16_t len, void* ctx)
+@brief Framer for length-prefixed protocols
+@details Each response starts with the length of the data that follows as 2 bytes, most significant first.
+@param buf
+	Received bytes
+@param len
+	Number of received bytes
+@param ctx
+	Unused
+@return <code>uint16_t</code>
+	Length of the first response including its length bytes, 0 if it is not complete
+*/
+uint16_t ELClientSocketPipeline::FrameLength(const uint8_t* buf, uint16_t len, void*)
+{
+	if (len < 2) return 0;
+	uint32_t n = ((uint32_t)buf[0] << 8 | buf[1]) + 2;
+	return n <= len ? n : 0;
+}
+
+/*! socketEvent(uint8_t resp_type, uint8_t client_num, uint16_t len, char *data)
+@brief Collect received bytes and complete the transactions whose responses are complete
+@details Bytes that arrive while no transaction is pending are counted in <code>stray</code> and dropped.
+	A response that does not fit into the buffer fails all pending transactions with TXN_OVERFLOW, a
+	connection error or disconnect fails them with TXN_FAILED.
+@note Internal library function
+@param resp_type
+	Response type
+@param client_num
+	Connection the event belongs to
+@param len
+	Size of the received packet, error code or connection state
+@param data
+	Received packet for USERCB_RECV
+*/
+void ELClientSocketPipeline::socketEvent(uint8_t resp_type, uint8_t, uint16_t len, char *data)
+{
+	if (resp_type == USERCB_RECO || (resp_type == USERCB_CONN && len == 0))
+	{
+		failAll(TXN_FAILED);
+		return;
+	}
+	if (resp_type != USERCB_RECV || data == NULL) return;
+
+	if (_count == 0)
+	{
+		stray += len;
+		return;
+	}
+	if (len > _bufSize - _len)
+	{
+		failAll(TXN_OVERFLOW);
+		return;
+	}
+	memcpy(_buf + _len, data, len);
+	_len += len;
+	// received while a doneCb runs, the loop that called it frames the new bytes
+	if (_inCallback) return;
+
+	while (_count != 0 && _len != 0)
+	{
+		uint16_t n = _framer(_buf, _len, _framerCtx);
+		if (n == 0) break;
+		if (n > _len) n = _len;
+		complete(TXN_OK, n);
+	}
+	if (_count == 0)
+	{
+		stray += _len;
+		_len = 0;
+	}
+}
+
+/*! service(uint32_t now)
+@brief Fail the pending transactions if one of them timed out
+@details The responses complete the transactions in order, so once one of them timed out the responses
+	still to come cannot be matched and all pending transactions fail with TXN_TIMEOUT.
+@note Internal library function
+@param now
+	Current millis()
+*/
+void ELClientSocketPipeline::service(uint32_t now)
+{
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		ELClientSocketTxn* txn = &_slots[(_head + i) % _size];
+		if (now - txn->sentAt >= txn->timeout)
+		{
+			failAll(TXN_TIMEOUT);
+			return;
+		}
+	}
+}
+
+/*! complete(uint8_t status, uint16_t len)
+@brief Complete the oldest pending transaction
+@details doneCb is called before the response is removed from the buffer and the slot is freed. Failing
+	the pending transactions from doneCb, e.g. by cancel(), is deferred until doneCb has returned and the
+	transaction is removed.
+@note Internal library function
+@param status
+	TXN_STATUS of the transaction
+@param len
+	Length of the response at the start of the buffer, 0 if the transaction failed
+*/
+void ELClientSocketPipeline::complete(uint8_t status, uint16_t len)
+{
+	ELClientSocketTxn* txn = &_slots[_head];
+	txn->status = status;
+	txn->resp = status == TXN_OK ? (const char*)_buf : NULL;
+	txn->respLen = len;
+	txn->doneAt = millis();
+	if (status == TXN_OK) completed++;
+	else failed++;
+
+	_inCallback = true;
+	if (txn->doneCb.attached()) txn->doneCb(txn);
+	_inCallback = false;
+
+	_len -= len;
+	memmove(_buf, _buf + len, _len);
+	_head = (_head + 1) % _size;
+	_count--;
+
+	if (_deferred != TXN_PENDING)
+	{
+		uint8_t deferred = _deferred;
+		_deferred = TXN_PENDING;
+		failAll(deferred);
+	}
+}
+
+/*! failAll(uint8_t status)
+@brief Fail all pending transactions and discard the received bytes
+@details Called while a doneCb runs it only records the status, complete() fails the transactions
+	once the callback has returned.
+@note Internal library function
+@param status
+	TXN_STATUS given to the transactions
+*/
+void ELClientSocketPipeline::failAll(uint8_t status)
+{
+	if (_inCallback)
+	{
+		if (_deferred == TXN_PENDING) _deferred = status;
+		return;
+	}
+	_len = 0;
+	// requests made from the doneCbs stay pending, a deferred failAll may already have failed the rest
+	for (uint8_t n = _count; n != 0 && _count != 0; n--) complete(status, 0);
+	// bytes received while the doneCbs ran belong to the failed transactions
+	_len = 0;
+}
@@ -0,0 +1,104 @@
+/*! \file ELClientSocketPipeline.h
+	\brief Definitions for ELClientSocketPipeline
+*/
+// Pipelined request/response transactions on a TCP client socket
+
+#ifndef _EL_CLIENT_SOCKET_PIPELINE_H_
+#define _EL_CLIENT_SOCKET_PIPELINE_H_
+
+#include <Arduino.h>
+#include "FP.h"
+#include "ELClient.h"
+#include "ELClientSocket.h"
+
+// Completion status of a transaction
+typedef enum {
+	TXN_PENDING = 0, /**< Waiting for the response */
+	TXN_OK,          /**< The response arrived, it is in resp and respLen */
+	TXN_TIMEOUT,     /**< A pending transaction got no response in time */
+	TXN_OVERFLOW,    /**< A response did not fit into the receive buffer */
+	TXN_FAILED,      /**< The connection failed or was closed before the response arrived */
+} TXN_STATUS;
+
+// One request/response exchange of an ELClientSocketPipeline
+typedef struct {
+	FP<void, void*> doneCb; /**< Called with a pointer to this transaction when it completes */
+	void* ctx;              /**< Free for use by doneCb */
+	uint8_t status;         /**< TXN_STATUS */
+	const char* resp;       /**< Response including its framing, only valid while doneCb runs, NULL if it failed */
+	uint16_t respLen;       /**< Length of the response */
+	uint32_t timeout;       /**< Milliseconds to wait for the response after the request */
+	uint32_t sentAt;        /**< millis() when the request was made */
+	uint32_t doneAt;        /**< millis() when the response arrived or the transaction failed */
+} ELClientSocketTxn;
+
+// Finds the end of the first response in the len bytes received at buf, ctx is the pointer
+// passed to setFramer. Returns the length of the response including its framing, or 0 if more
+// bytes are needed.
+typedef uint16_t (*ELClientFramer)(const uint8_t* buf, uint16_t len, void* ctx);
+
+// ELClientSocketPipeline matches responses to requests on a socket set up with
+// SOCKET_TCP_CLIENT_LISTEN. Requests go out back to back without waiting for the previous
+// response, the send window of the socket limits how many are in flight. The received bytes are
+// collected in a buffer and split into responses by a framer, e.g. FrameLine for line-oriented
+// protocols or FrameLength for length-prefixed ones. Responses complete the transactions in the
+// order of the requests, so the server has to answer in order, as most simple protocols do.
+// A timeout, an overflow or a closed connection fails all pending transactions, since the
+// responses still to come could not be matched to their requests any more.
+class ELClientSocketPipeline : public ELClientSocketListener, public ELClientService {
+	public:
+		// Create a pipeline on sock with up to count pending transactions in slots. Responses are
+		// assembled in the size bytes at buf, which must hold the longest response.
+		ELClientSocketPipeline(ELClient* e, ELClientSocket* sock, ELClientSocketTxn* slots, uint8_t count, uint8_t* buf, uint16_t size);
+
+		// Split the received bytes into responses with framer, FrameLine is the default
+		void setFramer(ELClientFramer framer, void* ctx=NULL);
+		// Timeout given to new transactions, DEFAULT_SOCKET_TIMEOUT is the default
+		void setTimeout(uint32_t timeout) { _timeout = timeout; }
+
+		// Send a framed request, returns the transaction so doneCb, ctx and timeout can be set, or
+		// NULL if all slots are pending or the socket could not take the data. The data must be
+		// null-terminated.
+		ELClientSocketTxn* request(const char* data);
+		// Send a framed request of len bytes
+		ELClientSocketTxn* request(const char* data, uint16_t len);
+
+		// Number of transactions waiting for their response
+		uint8_t pending(void) { return _count; }
+		// Fail all pending transactions with TXN_FAILED and discard the received bytes
+		void cancel(void);
+
+		// Framer for responses that end with a newline
+		static uint16_t FrameLine(const uint8_t* buf, uint16_t len, void* ctx);
+		// Framer for responses that start with a 2-byte big-endian length of the rest
+		static uint16_t FrameLength(const uint8_t* buf, uint16_t len, void* ctx);
+
+		// Collect received bytes and complete transactions, called by the socket
+		virtual void socketEvent(uint8_t resp_type, uint8_t client_num, uint16_t len, char *data);
+		// Fail the pending transactions once one of them timed out, called from ELClient::Process()
+		virtual void service(uint32_t now);
+
+		uint32_t completed; /**< Number of transactions completed with TXN_OK */
+		uint32_t failed;    /**< Number of transactions that timed out, overflowed or failed */
+		uint32_t stray;     /**< Number of received bytes that arrived with no transaction pending */
+
+	private:
+		ELClientSocket* _sock;      /**< Socket the requests are sent on */
+		ELClientSocketTxn* _slots;  /**< Queue of pending transactions */
+		uint8_t _size;              /**< Number of slots */
+		uint8_t _head;              /**< Slot of the oldest pending transaction */
+		uint8_t _count;             /**< Number of pending transactions */
+		uint8_t* _buf;              /**< Received bytes not yet taken by a response */
+		uint16_t _bufSize;          /**< Size of the receive buffer */
+		uint16_t _len;              /**< Number of bytes in the receive buffer */
+		ELClientFramer _framer;     /**< Finds the end of a response */
+		void* _framerCtx;           /**< Passed to the framer */
+		uint32_t _timeout;          /**< Timeout for new transactions */
+		boolean _inCallback;        /**< A doneCb is running */
+		uint8_t _deferred;          /**< Status to fail the pending transactions with once doneCb returns, TXN_PENDING if none */
+
+		void complete(uint8_t status, uint16_t len);
+		void failAll(uint8_t status);
+};
+
+#endif // _EL_CLIENT_SOCKET_PIPELINE_H_
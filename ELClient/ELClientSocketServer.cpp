@@ -0,0 +1,241 @@
+/*! \file ELClientSocketServer.cpp
+	\brief Constructor and functions for ELClientSocketServer and ELClientSocketSession
+*/
+#include "ELClientSocketServer.h"
+
+/*! ELClientSocketSession(ELClientSocket* sock, uint8_t* buf, uint16_t size)
+@brief Create a session for a client of a TCP server
+@details The session reads the data of its own client only. Writes go out on the server socket and are
+	not directed at the client of the session, see ELClientSocket::send.
+@param sock
+	Pointer to the server socket
+@param buf
+	Receive ring for the data of the client
+@param size
+	Size of the receive ring
+@par Example
+@code
+	class LineReader {
+		public:
+			LineReader() : len(0) {}
+			void onEvent(void* s) {
+				ELClientSocketSession* session = (ELClientSocketSession*)s;
+				if (session->event != SESSION_DATA) return;
+				while (session->available()) {
+					char c = session->read();
+					if (c != '\n') line[len++] = c;
+					if (c == '\n' || len == sizeof(line) - 1) {
+						line[len] = 0;
+						Serial.print(session->clientNum());
+						Serial.print(": ");
+						Serial.println(line);
+						len = 0;
+					}
+				}
+			}
+			char line[64];
+			uint8_t len;
+	};
+	LineReader reader[2];
+	uint8_t rx0[128], rx1[128];
+	ELClientSocketSession session0(&tcp, rx0, sizeof(rx0)), session1(&tcp, rx1, sizeof(rx1));
+	ELClientSocketServer server(&tcp);
+
+	void setup()
+	{
+		...
+		session0.handler.attach(&reader[0], &LineReader::onEvent);
+		session1.handler.attach(&reader[1], &LineReader::onEvent);
+		server.add(&session0);
+		server.add(&session1);
+		tcp.begin(tcpServer, tcpPort, SOCKET_TCP_SERVER);
+	}
+@endcode
+*/
+ELClientSocketSession::ELClientSocketSession(ELClientSocket* sock, uint8_t* buf, uint16_t size)
+	: ELClientSocketStream(sock, buf, size, SOCKET_ANY_CLIENT, false)
+{
+	event = SESSION_DISCONNECT;
+	lastError = 0;
+	connectedAt = 0;
+	user = NULL;
+}
+
+/*! bind(uint8_t client_num)
+@brief Bind the session to a client and notify the handler
+@note Internal library function
+@param client_num
+	Client number of the connection
+*/
+void ELClientSocketSession::bind(uint8_t client_num)
+{
+	_client = client_num;
+	clear();
+	dropped = 0;
+	lastError = 0;
+	connectedAt = millis();
+	notify(SESSION_CONNECT);
+}
+
+/*! notify(SESSION_EVENT ev)
+@brief Call the handler of the session
+@note Internal library function
+@param ev
+	Event to report
+*/
+void ELClientSocketSession::notify(SESSION_EVENT ev)
+{
+	event = ev;
+	if (handler.attached()) handler(this);
+}
+
+/*! ELClientSocketServer(ELClientSocket* sock)
+@brief Create a session table for a TCP server socket
+@details The server attaches itself to the socket, sessions are added with add().
+@param sock
+	Pointer to the socket, it is set up with begin and SOCKET_TCP_SERVER as usual
+*/
+ELClientSocketServer::ELClientSocketServer(ELClientSocket* sock)
+{
+	_sock = sock;
+	_count = 0;
+	rejected = 0;
+	for (uint8_t i = 0; i < SOCKET_MAX_CLIENTS; i++)
+	{
+		_table[i] = NULL;
+		_refused[i] = false;
+	}
+	_sock->attach(this);
+}
+
+/*! add(ELClientSocketSession* session)
+@brief Add a session that clients can be bound to
+@details Add as many sessions as clients should be served at the same time. Clients that connect while
+	all sessions are bound are counted once in <code>rejected</code> and their data is ignored until they
+	disconnect.
+@param session
+	Session created on the server socket
+@return <code>boolean</code>
+	False if SOCKET_MAX_CLIENTS sessions were already added
+*/
+boolean ELClientSocketServer::add(ELClientSocketSession* session)
+{
+	if (_count == SOCKET_MAX_CLIENTS) return false;
+	_pool[_count++] = session;
+	return true;
+}
+
+/*! session(uint8_t client_num)
+@brief Look up the session of a client
+@param client_num
+	Client number, as passed to the socket callback
+@return <code>ELClientSocketSession*</code>
+	Session bound to the client, NULL if the client is not connected
+*/
+ELClientSocketSession* ELClientSocketServer::session(uint8_t client_num)
+{
+	if (client_num >= SOCKET_MAX_CLIENTS) return NULL;
+	return _table[client_num];
+}
+
+/*! connections(void)
+@brief Number of connected clients
+@return <code>uint8_t</code>
+	Number of sessions bound to a client
+*/
+uint8_t ELClientSocketServer::connections(void)
+{
+	uint8_t n = 0;
+	for (uint8_t i = 0; i < SOCKET_MAX_CLIENTS; i++)
+	{
+		if (_table[i] != NULL) n++;
+	}
+	return n;
+}
+
+/*! bind(uint8_t client_num)
+@brief Bind a free session to a client
+@note Internal library function
+@param client_num
+	Client number of the new connection
+@return <code>ELClientSocketSession*</code>
+	The bound session, NULL if all sessions are in use
+*/
+ELClientSocketSession* ELClientSocketServer::bind(uint8_t client_num)
+{
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		if (!_pool[i]->connected())
+		{
+			_table[client_num] = _pool[i];
+			_pool[i]->bind(client_num);
+			return _pool[i];
+		}
+	}
+	if (!_refused[client_num])
+	{
+		_refused[client_num] = true;
+		rejected++;
+	}
+	return NULL;
+}
+
+/*! release(uint8_t client_num)
+@brief Notify the session of a client of the disconnect and release it
+@note Internal library function
+@param client_num
+	Client number of the closed connection
+*/
+void ELClientSocketServer::release(uint8_t client_num)
+{
+	ELClientSocketSession* s = _table[client_num];
+	if (s == NULL) return;
+	_table[client_num] = NULL;
+	s->notify(SESSION_DISCONNECT);
+	s->_client = SOCKET_ANY_CLIENT;
+}
+
+/*! socketEvent(uint8_t resp_type, uint8_t client_num, uint16_t len, char *data)
+@brief Route a socket event to the session of its client
+@details A client that sends data without a preceding connect event, e.g. because it connected before the
+	server was set up, is bound to a session as if it had just connected.
+@note Internal library function
+@param resp_type
+	Response type
+@param client_num
+	Client number the event belongs to
+@param len
+	Size of the data, number of sent bytes, error code or connection state
+@param data
+	Received data for USERCB_RECV
+*/
+void ELClientSocketServer::socketEvent(uint8_t resp_type, uint8_t client_num, uint16_t len, char *data)
+{
+	if (client_num >= SOCKET_MAX_CLIENTS) return;
+	ELClientSocketSession* s = _table[client_num];
+
+	if (resp_type == USERCB_CONN)
+	{
+		// a connect on a bound client number means the disconnect got lost
+		release(client_num);
+		_refused[client_num] = false;
+		if (len != 0) bind(client_num);
+		return;
+	}
+
+	if (resp_type == USERCB_RECV)
+	{
+		if (s == NULL && (s = bind(client_num)) == NULL) return;
+		s->socketEvent(resp_type, client_num, len, data);
+		s->notify(SESSION_DATA);
+	}
+	else if (s != NULL && resp_type == USERCB_SENT)
+	{
+		s->notify(SESSION_SENT);
+	}
+	else if (s != NULL && resp_type == USERCB_RECO)
+	{
+		s->lastError = (int16_t)len;
+		s->notify(SESSION_ERROR);
+	}
+}
@@ -0,0 +1,86 @@
+/*! \file ELClientSocketServer.h
+	\brief Definitions for ELClientSocketServer
+*/
+// Per-client sessions for a SOCKET_TCP_SERVER socket
+
+#ifndef _EL_CLIENT_SOCKET_SERVER_H_
+#define _EL_CLIENT_SOCKET_SERVER_H_
+
+#include <Arduino.h>
+#include "FP.h"
+#include "ELClientSocket.h"
+#include "ELClientSocketStream.h"
+
+#ifndef SOCKET_MAX_CLIENTS
+#define SOCKET_MAX_CLIENTS 4 /**< Number of client connections esp-link serves on one server socket */
+#endif
+
+// Events passed to the handler of a session
+typedef enum {
+	SESSION_CONNECT = 0, /**< A client connected and was bound to the session */
+	SESSION_DATA,        /**< Data from the client was appended to the receive ring */
+	SESSION_SENT,        /**< Data sent to the client was acknowledged */
+	SESSION_ERROR,       /**< Connection error, the code is in lastError */
+	SESSION_DISCONNECT,  /**< The client disconnected, the session is released after the handler returns */
+} SESSION_EVENT;
+
+// ELClientSocketSession holds the state of one client connected to an ELClientSocketServer. It is
+// a Stream whose receive ring holds the data of its client. The handler is called with a pointer
+// to the session for every event of its client, the event is in the event member. Writing to a
+// session sends on the server socket like ELClientSocket::send, esp-link has no way to address a
+// client, so it only reaches the client of the session while no other client is connected.
+class ELClientSocketSession : public ELClientSocketStream {
+	public:
+		// Create a session on a server socket with a receive ring of size bytes at buf
+		ELClientSocketSession(ELClientSocket* sock, uint8_t* buf, uint16_t size);
+
+		// True while a client is bound to the session
+		boolean connected(void) { return _client != SOCKET_ANY_CLIENT; }
+
+		FP<void, void*> handler; /**< Called with a pointer to the session for each event */
+		SESSION_EVENT event;     /**< Event the handler is called for */
+		int16_t lastError;       /**< Code of the last connection error, 0 if none */
+		uint32_t connectedAt;    /**< millis() when the client connected */
+		void* user;              /**< For use by the sketch, e.g. per-client parser state */
+
+	private:
+		friend class ELClientSocketServer;
+		void bind(uint8_t client_num);
+		void notify(SESSION_EVENT ev);
+};
+
+// ELClientSocketServer keeps a table of sessions for a socket set up with SOCKET_TCP_SERVER. When
+// a client connects one of the sessions added with add() is bound to its client number, and all
+// events of that client go to the session until it disconnects. The sketch thus handles each
+// client through its own session object instead of looking up per-client state in the socket
+// callback. The user callback of the socket still gets all events.
+class ELClientSocketServer : public ELClientSocketListener {
+	public:
+		ELClientSocketServer(ELClientSocket* sock);
+
+		// Add a session that can be bound to a client, returns false if SOCKET_MAX_CLIENTS sessions
+		// were already added
+		boolean add(ELClientSocketSession* session);
+
+		// Session bound to client client_num, NULL if the client is not connected
+		ELClientSocketSession* session(uint8_t client_num);
+		// Number of connected clients
+		uint8_t connections(void);
+
+		// Route an event to the session of its client, called by the socket
+		virtual void socketEvent(uint8_t resp_type, uint8_t client_num, uint16_t len, char *data);
+
+		uint32_t rejected; /**< Number of clients that connected while all sessions were bound */
+
+	private:
+		ELClientSocket* _sock; /**< Server socket */
+		ELClientSocketSession* _pool[SOCKET_MAX_CLIENTS];  /**< Sessions added to the server */
+		ELClientSocketSession* _table[SOCKET_MAX_CLIENTS]; /**< Session bound to each client number */
+		boolean _refused[SOCKET_MAX_CLIENTS]; /**< Client numbers counted in rejected until they disconnect */
+		uint8_t _count; /**< Number of sessions added */
+
+		ELClientSocketSession* bind(uint8_t client_num);
+		void release(uint8_t client_num);
+};
+
+#endif // _EL_CLIENT_SOCKET_SERVER_H_
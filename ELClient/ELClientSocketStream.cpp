@@ -0,0 +1,183 @@
+/*! \file ELClientSocketStream.cpp
+	\brief Constructor and functions for ELClientSocketStream
+*/
+#include "ELClientSocketStream.h"
+
+/*! ELClientSocketStream(ELClientSocket* sock, uint8_t* buf, uint16_t size, uint8_t client_num, boolean attach)
+@brief Create a stream on a socket connection
+@details The stream attaches itself to the socket, the user callback of the socket still gets all events.
+@param sock
+	Pointer to the socket, it is set up with begin as usual
+@param buf
+	Ring buffer for the received data
+@param size
+	Size of the ring buffer, should hold the data of a few packets
+@param client_num
+	(optional) Connection whose data is buffered, defaults to SOCKET_ANY_CLIENT
+@param attach
+	(optional) False if the stream is fed by another object instead of the socket, defaults to true
+@par Example
+@code
+	ELClientSocket tcp(&esp);
+	uint8_t rxBuf[256];
+	ELClientSocketStream tcpStream(&tcp, rxBuf, sizeof(rxBuf));
+
+	void loop()
+	{
+		esp.Process();
+		while (tcpStream.available())
+		{
+			parser.feed(tcpStream.read());
+		}
+	}
+@endcode
+*/
+ELClientSocketStream::ELClientSocketStream(ELClientSocket* sock, uint8_t* buf, uint16_t size, uint8_t client_num, boolean attach)
+{
+	_sock = sock;
+	_buf = buf;
+	_size = size;
+	_head = 0;
+	_count = 0;
+	_client = client_num;
+	dropped = 0;
+	if (attach) _sock->attach(this);
+}
+
+/*! socketEvent(uint8_t resp_type, uint8_t client_num, uint16_t len, char *data)
+@brief Append received data to the ring buffer
+@details Data that does not fit into the ring is dropped and counted in <code>dropped</code>.
+@note Internal library function
+@param resp_type
+	Response type, only USERCB_RECV events carry data
+@param client_num
+	Connection the event belongs to
+@param len
+	Size of the received packet
+@param data
+	Received packet
+*/
+void ELClientSocketStream::socketEvent(uint8_t resp_type, uint8_t client_num, uint16_t len, char *data)
+{
+	if (resp_type != USERCB_RECV || data == NULL) return;
+	if (_client != SOCKET_ANY_CLIENT && client_num != _client) return;
+
+	uint16_t room = _size - _count;
+	if (len > room)
+	{
+		dropped += len - room;
+		len = room;
+	}
+	uint16_t tail = _head + _count;
+	if (tail >= _size) tail -= _size;
+	uint16_t n = _size - tail;
+	if (n > len) n = len;
+	memcpy(_buf + tail, data, n);
+	memcpy(_buf, data + n, len - n);
+	_count += len;
+}
+
+/*! available(void)
+@brief Number of received bytes that can be read
+@return <code>int</code>
+	Number of bytes in the ring buffer
+*/
+int ELClientSocketStream::available(void)
+{
+	return _count;
+}
+
+/*! read(void)
+@brief Read the next received byte
+@details Does not wait for data, call esp.Process() in loop() to receive packets.
+@return <code>int</code>
+	The byte or -1 if no data has been received
+*/
+int ELClientSocketStream::read(void)
+{
+	if (_count == 0) return -1;
+	uint8_t c = _buf[_head];
+	if (++_head == _size) _head = 0;
+	_count--;
+	return c;
+}
+
+/*! peek(void)
+@brief Return the next received byte without removing it
+@return <code>int</code>
+	The byte or -1 if no data has been received
+*/
+int ELClientSocketStream::peek(void)
+{
+	if (_count == 0) return -1;
+	return _buf[_head];
+}
+
+/*! read(uint8_t* buf, uint16_t len)
+@brief Read several received bytes at once
+@details Unlike Stream::readBytes this does not wait for more data to arrive.
+@param buf
+	Buffer for the data
+@param len
+	Size of the buffer
+@return <code>uint16_t</code>
+	Number of bytes copied into buf
+*/
+uint16_t ELClientSocketStream::read(uint8_t* buf, uint16_t len)
+{
+	if (len > _count) len = _count;
+	uint16_t n = _size - _head;
+	if (n > len) n = len;
+	memcpy(buf, _buf + _head, n);
+	memcpy(buf + n, _buf, len - n);
+	_head += len;
+	if (_head >= _size) _head -= _size;
+	_count -= len;
+	return len;
+}
+
+/*! clear(void)
+@brief Discard all received data
+*/
+void ELClientSocketStream::clear(void)
+{
+	_head = 0;
+	_count = 0;
+}
+
+/*! write(uint8_t c)
+@brief Send a single byte
+@details Each call sends a packet of its own unless write coalescing is set on the socket, see
+	ELClientSocket::setCoalescing.
+@param c
+	Byte to send
+@return <code>size_t</code>
+	1 if the byte was sent, 0 if it could not be sent
+*/
+size_t ELClientSocketStream::write(uint8_t c)
+{
+	return write(&c, 1);
+}
+
+/*! write(const uint8_t* buf, size_t size)
+@brief Send a buffer on the socket
+@param buf
+	Data to send
+@param size
+	Number of bytes to send
+@return <code>size_t</code>
+	Number of bytes sent, 0 if the socket is not set up or its send queue is full
+*/
+size_t ELClientSocketStream::write(const uint8_t* buf, size_t size)
+{
+	if (size == 0 || !_sock->send((const char*)buf, size)) return 0;
+	return size;
+}
+
+/*! flush(void)
+@brief Send written data that is collected by write coalescing on the socket
+*/
+void ELClientSocketStream::flush(void)
+{
+	_sock->flush();
+}
@@ -0,0 +1,62 @@
+/*! \file ELClientSocketStream.h
+	\brief Definitions for ELClientSocketStream
+*/
+// Arduino Stream on top of an ELClientSocket connection
+
+#ifndef _EL_CLIENT_SOCKET_STREAM_H_
+#define _EL_CLIENT_SOCKET_STREAM_H_
+
+#include <Arduino.h>
+#include "ELClientSocket.h"
+
+// ELClientSocketStream makes the data received on one connection of a socket available as an
+// Arduino Stream, so parsers written for Serial or EthernetClient can read from esp-link TCP and
+// UDP sockets. Received packets are appended to a ring buffer supplied by the sketch as they
+// arrive, so nothing is lost when several packets arrive before the sketch reads them. Data that
+// does not fit into the ring is dropped and counted. Writing to the stream sends the data on the
+// socket. One stream per client number can be attached to a socket, e.g. one per client of a
+// TCP server.
+class ELClientSocketStream : public Stream, public ELClientSocketListener {
+	public:
+		// Create a stream for the data received on connection client_num of sock, buffered in the
+		// size bytes at buf. SOCKET_ANY_CLIENT takes the data of all connections. Without attach the
+		// stream only gets the events its owner passes on, e.g. an ELClientSocketServer.
+		ELClientSocketStream(ELClientSocket* sock, uint8_t* buf, uint16_t size, uint8_t client_num=SOCKET_ANY_CLIENT, boolean attach=true);
+
+		// Number of received bytes that can be read
+		virtual int available(void);
+		// Read the next received byte, returns -1 if there is none
+		virtual int read(void);
+		// Return the next received byte without removing it, returns -1 if there is none
+		virtual int peek(void);
+		// Read up to len received bytes into buf without waiting, returns the number of bytes read
+		uint16_t read(uint8_t* buf, uint16_t len);
+		// Discard all received bytes
+		void clear(void);
+
+		// Send a single byte on the socket
+		virtual size_t write(uint8_t c);
+		// Send size bytes on the socket as one packet
+		virtual size_t write(const uint8_t* buf, size_t size);
+		using Print::write;
+		// Send the written data that the socket is collecting for write coalescing
+		virtual void flush(void);
+
+		// Client number of the connection whose data is buffered
+		uint8_t clientNum(void) { return _client; }
+
+		// Append received data to the ring, called by the socket
+		virtual void socketEvent(uint8_t resp_type, uint8_t client_num, uint16_t len, char *data);
+
+		uint32_t dropped; /**< Number of received bytes dropped because the ring was full */
+
+	protected:
+		ELClientSocket* _sock; /**< Socket the stream reads from and writes to */
+		uint8_t* _buf;   /**< Ring buffer for received data */
+		uint16_t _size;  /**< Size of the ring buffer */
+		uint16_t _head;  /**< Position of the oldest received byte */
+		uint16_t _count; /**< Number of received bytes in the ring */
+		uint8_t _client; /**< Client number whose data is buffered */
+};
+
+#endif // _EL_CLIENT_SOCKET_STREAM_H_
@@ -0,0 +1,110 @@
+/*! \file ELClientStorage.cpp
+    \brief Constructor and functions for ELClientStorage
+*/
+#include "ELClientStorage.h"
+
+#ifdef __AVR__
+#include <EEPROM.h>
+
+/*! ELClientEEPROMStorage(uint16_t start, uint16_t size)
+@brief Create a storage in a range of the internal EEPROM
+@param start
+  First EEPROM address to use
+@param size
+  Number of bytes to use
+@par Example
+@code
+  // use the upper 512 bytes of the 1KB EEPROM of an ATmega328
+  ELClientEEPROMStorage storage(512, 512);
+@endcode
+*/
+ELClientEEPROMStorage::ELClientEEPROMStorage(uint16_t start, uint16_t size) :
+  _start(start), _size(size)
+{
+}
+
+/*! read(uint16_t addr)
+@brief Read a byte
+@param addr
+  Address relative to the start of the range
+@return <code>uint8_t</code>
+  Byte read
+*/
+uint8_t ELClientEEPROMStorage::read(uint16_t addr) {
+  return EEPROM.read(_start + addr);
+}
+
+/*! write(uint16_t addr, uint8_t value)
+@brief Write a byte
+@details The byte is only written if it changes, to save EEPROM write cycles
+@param addr
+  Address relative to the start of the range
+@param value
+  Byte to write
+*/
+void ELClientEEPROMStorage::write(uint16_t addr, uint8_t value) {
+  EEPROM.update(_start + addr, value);
+}
+
+#else
+
+/*! ELClientFileStorage(const char* path, uint16_t size)
+@brief Create a storage in a file on the host
+@param path
+  Path of the file
+@param size
+  Number of bytes to use
+@par Example
+@code
+  ELClientFileStorage storage("outbox.bin", 512);
+@endcode
+*/
+ELClientFileStorage::ELClientFileStorage(const char* path, uint16_t size) :
+  _size(size)
+{
+  _file = fopen(path, "r+b");
+  if (_file == NULL) {
+    _file = fopen(path, "w+b");
+    if (_file == NULL) return;
+    for (uint16_t i=0; i<size; i++) fputc(0xFF, _file);
+    fflush(_file);
+  }
+}
+
+ELClientFileStorage::~ELClientFileStorage() {
+  if (_file != NULL) fclose(_file);
+}
+
+/*! read(uint16_t addr)
+@brief Read a byte
+@param addr
+  Offset in the file
+@return <code>uint8_t</code>
+  Byte read, 0xFF past the end of the file
+*/
+uint8_t ELClientFileStorage::read(uint16_t addr) {
+  if (_file == NULL || fseek(_file, addr, SEEK_SET) != 0) return 0xFF;
+  int c = fgetc(_file);
+  return c == EOF ? 0xFF : c;
+}
+
+/*! write(uint16_t addr, uint8_t value)
+@brief Write a byte
+@param addr
+  Offset in the file
+@param value
+  Byte to write
+*/
+void ELClientFileStorage::write(uint16_t addr, uint8_t value) {
+  if (_file == NULL || fseek(_file, addr, SEEK_SET) != 0) return;
+  fputc(value, _file);
+}
+
+/*! commit(void)
+@brief Flush the writes to the file
+*/
+void ELClientFileStorage::commit(void) {
+  if (_file != NULL) fflush(_file);
+}
+
+#endif
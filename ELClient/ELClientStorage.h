@@ -0,0 +1,60 @@
+/*! \file ELClientStorage.h
+    \brief Definitions for ELClientStorage
+*/
+// Byte-addressed persistent storage backends
+
+#ifndef _EL_CLIENT_STORAGE_H_
+#define _EL_CLIENT_STORAGE_H_
+
+#include <Arduino.h>
+
+// ELClientStorage is the interface to a small byte-addressed persistent store, such as the
+// EEPROM, used by library parts that need to keep data across resets. Implement it to use other
+// storage, e.g. an external I2C EEPROM or FRAM.
+class ELClientStorage {
+  public:
+    // Number of bytes available
+    virtual uint16_t size(void) = 0;
+    // Read the byte at addr
+    virtual uint8_t read(uint16_t addr) = 0;
+    // Write the byte at addr, implementations should skip writes that don't change the byte
+    virtual void write(uint16_t addr, uint8_t value) = 0;
+    // Make sure all writes are persisted
+    virtual void commit(void) {}
+};
+
+#ifdef __AVR__
+// Storage in a range of the internal EEPROM
+class ELClientEEPROMStorage : public ELClientStorage {
+  public:
+    // Use size bytes of the EEPROM starting at start
+    ELClientEEPROMStorage(uint16_t start, uint16_t size);
+    virtual uint16_t size(void) { return _size; }
+    virtual uint8_t read(uint16_t addr);
+    virtual void write(uint16_t addr, uint8_t value);
+
+  private:
+    uint16_t _start; /**< First EEPROM address used */
+    uint16_t _size;  /**< Number of bytes used */
+};
+#else
+#include <stdio.h>
+
+// Storage in a file, for running and testing sketches on a host
+class ELClientFileStorage : public ELClientStorage {
+  public:
+    // Use a file of size bytes, the file is created filled with 0xFF if it doesn't exist
+    ELClientFileStorage(const char* path, uint16_t size);
+    ~ELClientFileStorage();
+    virtual uint16_t size(void) { return _file != NULL ? _size : 0; }
+    virtual uint8_t read(uint16_t addr);
+    virtual void write(uint16_t addr, uint8_t value);
+    virtual void commit(void);
+
+  private:
+    FILE* _file;    /**< Backing file, NULL if it couldn't be opened */
+    uint16_t _size; /**< Number of bytes used */
+};
+#endif
+
+#endif // _EL_CLIENT_STORAGE_H_
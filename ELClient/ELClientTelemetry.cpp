@@ -0,0 +1,221 @@
+/*! \file ELClientTelemetry.cpp
+    \brief Constructor and functions for ELClientTelemetry
+*/
+#include "ELClientTelemetry.h"
+
+/*! ELClientTelemetryChannel(const char* topic, float deadband, float percent, uint32_t minInterval, uint32_t maxInterval)
+@brief Create a telemetry channel
+@param topic
+  Topic the value is published to
+@param deadband
+  Minimum absolute change of the value to publish it, 0 to not use an absolute threshold
+@param percent
+  (optional) Minimum change relative to the last published value in percent, 0 to not use a relative threshold
+@param minInterval
+  (optional) Minimum time between two publishes in milliseconds
+@param maxInterval
+  (optional) Time after which an unchanged value is published again as a heartbeat, 0 for never
+@par Example
+@code
+  // publish the temperature when it changes by 0.2 degrees, at most every 5 seconds and
+  // at least every 5 minutes
+  ELClientTelemetryChannel temperature("/esp-link/1/temp", 0.2, 0, 5000, 300000);
+@endcode
+*/
+ELClientTelemetryChannel::ELClientTelemetryChannel(const char* topic, float deadband, float percent,
+    uint32_t minInterval, uint32_t maxInterval) :
+  decimals(2), qos(0), retain(0), _topic(topic), _flashTopic(false), _deadband(deadband),
+  _percent(percent), _minInterval(minInterval), _maxInterval(maxInterval), _value(0), _published(0),
+  _publishedAt(0), _valid(false), _force(false), _sent(false), _owner(0), _next(0)
+{
+}
+
+/*! ELClientTelemetryChannel(const __FlashStringHelper* topic, float deadband, float percent, uint32_t minInterval, uint32_t maxInterval)
+@brief Create a telemetry channel with the topic stored in program memory
+@param topic
+  Topic the value is published to
+@param deadband
+  Minimum absolute change of the value to publish it, 0 to not use an absolute threshold
+@param percent
+  (optional) Minimum change relative to the last published value in percent, 0 to not use a relative threshold
+@param minInterval
+  (optional) Minimum time between two publishes in milliseconds
+@param maxInterval
+  (optional) Time after which an unchanged value is published again as a heartbeat, 0 for never
+@par Example
+@code
+  // publish the humidity when it changes by 2%, at most every 10 seconds
+  ELClientTelemetryChannel humidity(F("/esp-link/1/hum"), 0, 2, 10000);
+@endcode
+*/
+ELClientTelemetryChannel::ELClientTelemetryChannel(const __FlashStringHelper* topic, float deadband,
+    float percent, uint32_t minInterval, uint32_t maxInterval) :
+  decimals(2), qos(0), retain(0), _topic((const char*)topic), _flashTopic(true), _deadband(deadband),
+  _percent(percent), _minInterval(minInterval), _maxInterval(maxInterval), _value(0), _published(0),
+  _publishedAt(0), _valid(false), _force(false), _sent(false), _owner(0), _next(0)
+{
+}
+
+/*! set(float value)
+@brief Update the value of the channel
+@details Only records the value, the decision whether to publish it is made when the channels
+  are serviced from ELClient::Process().
+@param value
+  New value
+@par Example
+@code
+  void loop() {
+    esp.Process();
+    temperature.set(readTemperature());
+  }
+@endcode
+*/
+void ELClientTelemetryChannel::set(float value) {
+  _value = value;
+  _valid = true;
+  if (_owner != NULL) _owner->updates++;
+}
+
+/*! due(uint32_t now)
+@brief Check whether the value of the channel should be published
+@note Internal library function
+@param now
+  Current time in milliseconds
+@return <code>boolean</code>
+  True if the value should be published
+*/
+boolean ELClientTelemetryChannel::due(uint32_t now) {
+  if (!_valid) return false;
+  if (!_sent || _force) return true;
+  uint32_t age = now - _publishedAt;
+  if (age < _minInterval) return false;
+  if (_maxInterval != 0 && age >= _maxInterval) return true;
+
+  float diff = _value - _published;
+  if (diff < 0) diff = -diff;
+  if (_deadband == 0 && _percent == 0) return diff != 0;
+  if (_deadband != 0 && diff >= _deadband) return true;
+  if (_percent != 0) {
+    float ref = _published < 0 ? -_published : _published;
+    if (diff * 100 >= ref * _percent && diff != 0) return true;
+  }
+  return false;
+}
+
+/*! printValue(Print* out, uint16_t chunk, void* ctx)
+@brief Producer that prints the value of a channel
+@note Internal library function
+*/
+boolean ELClientTelemetryChannel::printValue(Print* out, uint16_t, void* ctx) {
+  ELClientTelemetryChannel* ch = (ELClientTelemetryChannel*)ctx;
+  out->print(ch->_value, ch->decimals);
+  return false;
+}
+
+/*! ELClientTelemetry(ELClient* elc, ELClientMqtt* mqtt)
+@brief Create a telemetry publisher
+@param elc
+  Pointer to ELClient, whose Process() services the channels
+@param mqtt
+  Pointer to the MQTT client used to publish
+@par Example
+@code
+  ELClient esp(&Serial);
+  ELClientMqtt mqtt(&esp);
+  ELClientTelemetry telemetry(&esp, &mqtt);
+@endcode
+*/
+ELClientTelemetry::ELClientTelemetry(ELClient* elc, ELClientMqtt* mqtt) :
+  maxPerPass(4), updates(0), published(0), _elc(elc), _mqtt(mqtt), _channels(0), _cursor(0)
+{
+}
+
+/*! add(ELClientTelemetryChannel* channel)
+@brief Add a channel
+@details A channel belongs to one telemetry at a time, a channel added to another telemetry is
+  moved from there.
+@param channel
+  Channel to add, it must remain valid while it is in use
+@par Example
+@code
+  telemetry.add(&temperature);
+  telemetry.add(&humidity);
+  telemetry.begin();
+@endcode
+*/
+void ELClientTelemetry::add(ELClientTelemetryChannel* channel) {
+  if (channel->_owner == this) return;
+  if (channel->_owner != NULL) channel->_owner->remove(channel);
+  channel->_owner = this;
+  channel->_next = _channels;
+  _channels = channel;
+}
+
+/*! remove(ELClientTelemetryChannel* channel)
+@brief Remove a channel
+@param channel
+  Channel to remove
+*/
+void ELClientTelemetry::remove(ELClientTelemetryChannel* channel) {
+  ELClientTelemetryChannel** link = &_channels;
+  while (*link != NULL) {
+    if (*link == channel) {
+      *link = channel->_next;
+      if (_cursor == channel) _cursor = channel->_next;
+      channel->_next = NULL;
+      channel->_owner = NULL;
+      return;
+    }
+    link = &(*link)->_next;
+  }
+}
+
+/*! begin(void)
+@brief Start servicing the channels
+@details Attaches the telemetry to ELClient so the channels are checked from Process()
+*/
+void ELClientTelemetry::begin(void) {
+  _elc->attachService(this);
+}
+
+/*! end(void)
+@brief Stop servicing the channels
+*/
+void ELClientTelemetry::end(void) {
+  _elc->detachService(this);
+}
+
+/*! service(uint32_t now)
+@brief Publish all channels that are due
+@details Checks all channels in a single pass and publishes those that are due, up to maxPerPass
+  messages. The next pass starts with the channel after the last one published so all channels
+  get their turn when many are due at once.
+@note Internal library function, called from ELClient::Process()
+@param now
+  Current time in milliseconds
+*/
+void ELClientTelemetry::service(uint32_t now) {
+  if (_channels == NULL || !_mqtt->connected()) return;
+  if (_cursor == NULL) _cursor = _channels;
+
+  ELClientTelemetryChannel* ch = _cursor;
+  uint8_t sent = 0;
+  do {
+    if (ch->due(now)) {
+      if (sent >= maxPerPass) break;
+      if (ch->_flashTopic)
+        _mqtt->publish((const __FlashStringHelper*)ch->_topic, &ELClientTelemetryChannel::printValue,
+            ch, 0, ch->qos, ch->retain);
+      else
+        _mqtt->publish(ch->_topic, &ELClientTelemetryChannel::printValue, ch, 0, ch->qos, ch->retain);
+      ch->_published = ch->_value;
+      ch->_publishedAt = now;
+      ch->_sent = true;
+      ch->_force = false;
+      published++;
+      sent++;
+    }
+    ch = ch->_next != NULL ? ch->_next : _channels;
+  } while (ch != _cursor);
+  _cursor = ch;
+}
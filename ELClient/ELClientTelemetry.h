@@ -0,0 +1,94 @@
+/*! \file ELClientTelemetry.h
+    \brief Definitions for ELClientTelemetry
+*/
+// Deadband and rate-limited publishing of sensor values over MQTT
+
+#ifndef _EL_CLIENT_TELEMETRY_H_
+#define _EL_CLIENT_TELEMETRY_H_
+
+#include <Arduino.h>
+#include "ELClient.h"
+#include "ELClientMqtt.h"
+
+class ELClientTelemetry;
+
+// A telemetry channel holds the latest value of one sensor and decides when it is worth
+// publishing to its topic. A new value is published if it differs from the last published value
+// by at least the deadband or by at least the percentage of the last published value, but never
+// more often than every minInterval milliseconds. If maxInterval is not 0 the value is
+// re-published as a heartbeat when it hasn't been published for that long. With a deadband and
+// percentage of 0 every change is published. The topic must remain valid while the channel is
+// in use.
+class ELClientTelemetryChannel {
+  public:
+    ELClientTelemetryChannel(const char* topic, float deadband, float percent=0,
+        uint32_t minInterval=0, uint32_t maxInterval=0);
+    ELClientTelemetryChannel(const __FlashStringHelper* topic, float deadband, float percent=0,
+        uint32_t minInterval=0, uint32_t maxInterval=0);
+
+    // Update the value of the channel, this is cheap and can be called on every loop
+    void set(float value);
+    // Latest value set
+    float value(void) { return _value; }
+    // Force the next service pass to publish the value regardless of deadband and intervals
+    void touch(void) { _force = true; }
+
+    uint8_t decimals; /**< Number of decimals published, default 2 */
+    uint8_t qos;      /**< MQTT qos level, default 0 */
+    uint8_t retain;   /**< MQTT retain flag, default 0 */
+
+  private:
+    friend class ELClientTelemetry;
+    boolean due(uint32_t now);
+    static boolean printValue(Print* out, uint16_t chunk, void* ctx);
+
+    const char* _topic;     /**< Topic to publish to */
+    boolean _flashTopic;    /**< Topic is stored in program memory */
+    float _deadband;        /**< Minimum absolute change to publish */
+    float _percent;         /**< Minimum change relative to the last published value, in percent */
+    uint32_t _minInterval;  /**< Minimum time between publishes in milliseconds */
+    uint32_t _maxInterval;  /**< Heartbeat interval in milliseconds, 0 for none */
+    float _value;           /**< Latest value */
+    float _published;       /**< Last published value */
+    uint32_t _publishedAt;  /**< Time of the last publish */
+    boolean _valid;         /**< A value has been set */
+    boolean _force;         /**< Publish on the next pass */
+    boolean _sent;          /**< The value has been published at least once */
+    ELClientTelemetry* _owner; /**< Telemetry the channel has been added to */
+    ELClientTelemetryChannel* _next; /**< Next channel in the list */
+};
+
+// ELClientTelemetry services a list of telemetry channels from ELClient::Process(). On each pass
+// all channels are checked in one go and those that are due are published, up to maxPerPass
+// messages per pass so a burst of changes doesn't flood the serial link. Nothing is published
+// while MQTT is disconnected; channels that become due meanwhile are published after reconnecting.
+class ELClientTelemetry : public ELClientService {
+  public:
+    ELClientTelemetry(ELClient* elc, ELClientMqtt* mqtt);
+
+    // Add a channel, channels must remain valid while they are in use. A channel that was added
+    // to another telemetry is moved.
+    void add(ELClientTelemetryChannel* channel);
+    // Remove a channel
+    void remove(ELClientTelemetryChannel* channel);
+
+    // Start servicing the channels from ELClient::Process()
+    void begin(void);
+    // Stop servicing the channels
+    void end(void);
+
+    // Check all channels and publish those that are due, called from ELClient::Process()
+    virtual void service(uint32_t now);
+
+    uint8_t maxPerPass;  /**< Maximum number of messages published per pass, default 4 */
+    uint32_t updates;    /**< Number of values set on all channels */
+    uint32_t published;  /**< Number of values published */
+
+  private:
+    ELClient* _elc; /**< ELClient instance */
+    ELClientMqtt* _mqtt; /**< MQTT client used for publishing */
+    ELClientTelemetryChannel* _channels; /**< List of channels */
+    ELClientTelemetryChannel* _cursor; /**< Channel the next pass starts with */
+};
+
+#endif // _EL_CLIENT_TELEMETRY_H_
@@ -38,7 +38,7 @@ bool connected;
 // Callback when MQTT is connected
 void mqttConnected(void* response) {
   Serial.println("MQTT connected!");
-  mqtt.subscribe("/esp-link/1");
+  mqtt.subscribe(MQTT_RELATIVE, "1"); // i.e. /esp-link/1
   mqtt.subscribe("/hello/world/#");
   //mqtt.subscribe("/esp-link/2", 1);
   //mqtt.publish("/esp-link/0", "test1");
@@ -88,6 +88,8 @@ void setup() {
   mqtt.disconnectedCb.attach(mqttDisconnected);
   mqtt.publishedCb.attach(mqttPublished);
   mqtt.dataCb.attach(mqttData);
+  // Topics published and subscribed with MQTT_RELATIVE get this prefix prepended by esp-link
+  mqtt.setPrefix("/esp-link/");
   mqtt.setup();
 
   //Serial.println("ARDUINO: setup mqtt lwt");
@@ -107,7 +109,7 @@ void loop() {
     char buf[12];
 
     itoa(count++, buf, 10);
-    mqtt.publish("/esp-link/1", buf);
+    mqtt.publish(MQTT_RELATIVE, "1", buf); // i.e. /esp-link/1
 
     itoa(count+99, buf, 10);
     mqtt.publish("/hello/world/arduino", buf);
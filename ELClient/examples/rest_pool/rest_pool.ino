@@ -0,0 +1,87 @@
+/**
+ * Example measuring the REST request throughput with 1 to 4 connections to the same server
+ */
+
+#include <ELClient.h>
+#include <ELClientRest.h>
+#include <ELClientRestPool.h>
+
+// Initialize a connection to esp-link using the normal hardware serial port both for
+// SLIP and for debug messages.
+ELClient esp(&Serial, &Serial);
+
+// esp-link supports up to 4 REST clients, the pool spreads the requests over them
+ELClientRest rest1(&esp), rest2(&esp), rest3(&esp), rest4(&esp);
+ELClientRestPool pool(&esp);
+
+// Requests waiting for an idle connection
+ELClientRestRequest queue[8];
+
+boolean wifiConnected = false;
+
+// Callback made from esp-link to notify of wifi status changes
+void wifiCb(void *response) {
+  ELClientResponse *res = (ELClientResponse*)response;
+  if (res->argc() == 1) {
+    uint8_t status;
+    res->popArg(&status, 1);
+    wifiConnected = status == STATION_GOT_IP;
+  }
+}
+
+void setup() {
+  Serial.begin(115200);   // the baud rate here needs to match the esp-link config
+  Serial.println("EL-Client starting!");
+
+  esp.wifiCb.attach(wifiCb);
+  bool ok;
+  do {
+    ok = esp.Sync();      // sync up with esp-link, blocks for up to 2 seconds
+    if (!ok) Serial.println("EL-Client sync failed!");
+  } while(!ok);
+  Serial.println("EL-Client synced!");
+
+  pool.add(&rest1);
+  pool.add(&rest2);
+  pool.add(&rest3);
+  pool.add(&rest4);
+  pool.setQueue(queue, 8);
+  uint8_t n = pool.begin("www.timeapi.org");
+  Serial.print("EL-REST pool ready with ");
+  Serial.print(n);
+  Serial.println(" connections");
+  pool.setActive(1);
+}
+
+#define MEASURE_TIME 30000 // measure each number of connections for 30 seconds
+
+uint32_t measureStart = 0;
+
+void loop() {
+  // process any callbacks coming from esp_link, this also sends the queued requests
+  esp.Process();
+
+  if (!wifiConnected) return;
+
+  // keep the queue full
+  while (pool.enqueue("/utc/now", "GET") != NULL) ;
+
+  if (measureStart == 0) {
+    measureStart = millis();
+    pool.resetStats();
+  } else if (millis() - measureStart >= MEASURE_TIME) {
+    Serial.print("ARDUINO: connections=");
+    Serial.print(pool.active());
+    Serial.print(" ok=");
+    Serial.print(pool.completed);
+    Serial.print(" errors=");
+    Serial.print(pool.errors);
+    Serial.print(" timeouts=");
+    Serial.print(pool.timeouts);
+    Serial.print(" requests/min=");
+    Serial.println(pool.throughput());
+    // continue with one more connection, starting over after all of them
+    pool.setActive(pool.active() < pool.connections() ? pool.active() + 1 : 1);
+    measureStart = 0;
+  }
+}
@@ -0,0 +1,120 @@
+/**
+ * Example measuring the packets and UART bytes that write coalescing saves on a TCP socket
+ */
+
+#include <ELClient.h>
+#include <ELClientSocket.h>
+
+// TCP server that takes the data, e.g. `socat TCP-LISTEN:5000,fork,reuseaddr OPEN:/dev/null` on a PC.
+// Replace it with the address of your server.
+char * const tcpServer PROGMEM = "192.168.0.102";
+uint16_t const tcpPort PROGMEM = 5000;
+
+#define TOTAL 1024       // bytes sent per measurement
+#define COALESCE_SIZE 100 // size of the coalescing buffer
+
+// Passes everything through to the serial port and counts the bytes and packets sent to esp-link
+class CountingStream : public Stream {
+	public:
+		CountingStream(Stream* s) : bytes(0), packets(0), _s(s) {}
+
+		int available() { return _s->available(); }
+		int read() { return _s->read(); }
+		int peek() { return _s->peek(); }
+		void flush() { _s->flush(); }
+		size_t write(uint8_t c) {
+			bytes++;
+			// each packet starts and ends with SLIP_END
+			if (c == 0300) packets++;
+			return _s->write(c);
+		}
+		using Print::write;
+
+		uint32_t bytes;
+		uint32_t packets; // SLIP_END bytes, two per packet
+	private:
+		Stream* _s;
+};
+
+CountingStream wire(&Serial);
+
+// Initialize a connection to esp-link through the counting stream. Debug messages are left off,
+// the serial port carries the SLIP messages being counted.
+ELClient esp(&wire);
+
+ELClientSocket tcp(&esp);
+uint8_t merge[COALESCE_SIZE];
+
+boolean wifiConnected = false;
+
+// Callback made from esp-link to notify of wifi status changes
+void wifiCb(void *response) {
+	ELClientResponse *res = (ELClientResponse*)response;
+	if (res->argc() == 1) {
+		uint8_t status;
+		res->popArg(&status, 1);
+		wifiConnected = status == STATION_GOT_IP;
+	}
+}
+
+void setup() {
+	Serial.begin(115200);   // the baud rate here needs to match the esp-link config
+	Serial.println(F("EL-Client starting!"));
+
+	esp.wifiCb.attach(wifiCb);
+	bool ok;
+	do {
+		ok = esp.Sync();      // sync up with esp-link, blocks for up to 2 seconds
+		if (!ok) Serial.println(F("EL-Client sync failed!"));
+	} while(!ok);
+	Serial.println(F("EL-Client synced!"));
+
+	int err = tcp.begin(tcpServer, tcpPort, SOCKET_TCP_CLIENT);
+	if (err < 0) {
+		Serial.print(F("TCP begin failed: "));
+		Serial.println(err);
+	}
+	Serial.println(F("EL-TCP ready"));
+}
+
+// Send TOTAL bytes in pieces of piece bytes and print the packets and bytes it took
+void measure(uint8_t piece, boolean coalesce) {
+	static const char data[] = "0123456789abcdef0123456789abcdef";
+	if (coalesce) tcp.setCoalescing(merge, sizeof(merge));
+	uint32_t bytes = wire.bytes;
+	uint32_t packets = wire.packets;
+	for (uint16_t sent = 0; sent < TOTAL; sent += piece) tcp.send(data, piece);
+	tcp.flush();
+	bytes = wire.bytes - bytes;
+	packets = (wire.packets - packets) / 2;
+	if (coalesce) tcp.setCoalescing(NULL, 0);
+
+	Serial.print(F("ARDUINO: piece="));
+	Serial.print(piece);
+	Serial.print(coalesce ? F(" coalescing=on") : F(" coalescing=off"));
+	Serial.print(F(" packets="));
+	Serial.print(packets);
+	Serial.print(F(" bytes="));
+	Serial.print(bytes);
+	Serial.print(F(" packets/KB="));
+	Serial.println(packets * 1024 / TOTAL);
+}
+
+#define REPORT_INTERVAL 10000 // measure every 10 seconds
+
+uint32_t reportAt = 0;
+
+void loop() {
+	// process any callbacks coming from esp_link
+	esp.Process();
+
+	if (!wifiConnected) return;
+
+	if (millis() - reportAt >= REPORT_INTERVAL) {
+		reportAt = millis();
+		measure(8, false);
+		measure(8, true);
+		measure(16, false);
+		measure(16, true);
+	}
+}
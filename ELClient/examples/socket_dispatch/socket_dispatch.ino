@@ -0,0 +1,148 @@
+/**
+ * Example measuring the cost of dispatching socket events with four live UDP sockets
+ */
+
+#include <ELClient.h>
+#include <ELClientSocket.h>
+
+// UDP echo server the datagrams are sent to, e.g. `socat UDP-RECVFROM:5000,fork EXEC:cat` on a PC.
+// Replace it with the address of your server.
+char * const udpServer PROGMEM = "192.168.0.102";
+uint16_t const udpPort PROGMEM = 5000;
+
+// How events get to the object that owns a socket:
+// 0 = one global callback that looks the channel up by socket, as the older examples do
+// 1 = callback with context pointer, begin(host, port, mode, cb, ctx)
+// 2 = eventCb bound to a member function
+#define DISPATCH 2
+
+// Initialize a connection to esp-link using the normal hardware serial port for SLIP messages.
+// Debug messages are left off, printing them would take far longer than the dispatch being timed.
+ELClient esp(&Serial);
+
+// One channel per socket, the object the events are meant for
+class Channel {
+	public:
+		Channel() : events(0), bytes(0) {}
+
+		void onEvent(void* e) {
+			ELClientSocketEvent* ev = (ELClientSocketEvent*)e;
+			handle(ev->resp_type, ev->len);
+		}
+		static void onSocket(void* ctx, uint8_t resp_type, uint8_t client_num, uint16_t len, char *data) {
+			((Channel*)ctx)->handle(resp_type, len);
+		}
+		void handle(uint8_t resp_type, uint16_t len) {
+			events++;
+			if (resp_type == USERCB_RECV) bytes += len;
+		}
+
+		uint32_t events;
+		uint32_t bytes;
+};
+
+ELClientSocket udp[4] = { ELClientSocket(&esp), ELClientSocket(&esp), ELClientSocket(&esp), ELClientSocket(&esp) };
+Channel channel[4];
+
+// Global callback, has to find the channel of the socket by its connection number
+void udpCb(uint8_t resp_type, uint8_t client_num, uint16_t len, char *data) {
+	for (uint8_t i = 0; i < 4; i++) {
+		if (udp[i].remote_instance == client_num) {
+			channel[i].handle(resp_type, len);
+			return;
+		}
+	}
+}
+
+boolean wifiConnected = false;
+
+// Callback made from esp-link to notify of wifi status changes
+void wifiCb(void *response) {
+	ELClientResponse *res = (ELClientResponse*)response;
+	if (res->argc() == 1) {
+		uint8_t status;
+		res->popArg(&status, 1);
+		wifiConnected = status == STATION_GOT_IP;
+	}
+}
+
+void setup() {
+	Serial.begin(115200);   // the baud rate here needs to match the esp-link config
+	Serial.println(F("EL-Client starting!"));
+
+	esp.wifiCb.attach(wifiCb);
+	bool ok;
+	do {
+		ok = esp.Sync();      // sync up with esp-link, blocks for up to 2 seconds
+		if (!ok) Serial.println(F("EL-Client sync failed!"));
+	} while(!ok);
+	Serial.println(F("EL-Client synced!"));
+
+	for (uint8_t i = 0; i < 4; i++) {
+#if DISPATCH == 0
+		int err = udp[i].begin(udpServer, udpPort, SOCKET_UDP, udpCb);
+#elif DISPATCH == 1
+		int err = udp[i].begin(udpServer, udpPort, SOCKET_UDP, Channel::onSocket, &channel[i]);
+#else
+		int err = udp[i].begin(udpServer, udpPort, SOCKET_UDP);
+		udp[i].eventCb.attach(&channel[i], &Channel::onEvent);
+#endif
+		if (err < 0) {
+			Serial.print(F("UDP begin failed: "));
+			Serial.println(err);
+		}
+	}
+	Serial.print(F("EL-UDP ready, dispatch mode "));
+	Serial.println(DISPATCH);
+}
+
+#define SEND_INTERVAL 50     // send a datagram on each socket every 50ms
+#define REPORT_INTERVAL 10000 // print the measurement every 10 seconds
+
+uint32_t sendAt = 0;
+uint32_t reportAt = 0;
+uint32_t processMicros = 0; // time spent in Process() calls that dispatched events
+uint32_t processEvents = 0; // number of events dispatched by those calls
+
+uint32_t totalEvents() {
+	uint32_t n = 0;
+	for (uint8_t i = 0; i < 4; i++) n += channel[i].events;
+	return n;
+}
+
+void loop() {
+	// process any callbacks coming from esp_link and time the calls that dispatch events
+	uint32_t before = totalEvents();
+	uint32_t start = micros();
+	esp.Process();
+	uint32_t took = micros() - start;
+	uint32_t n = totalEvents() - before;
+	if (n != 0) {
+		processMicros += took;
+		processEvents += n;
+	}
+
+	if (!wifiConnected) return;
+
+	if (millis() - sendAt >= SEND_INTERVAL) {
+		sendAt = millis();
+		for (uint8_t i = 0; i < 4; i++) udp[i].send("0123456789abcdef");
+	}
+
+	if (millis() - reportAt >= REPORT_INTERVAL) {
+		reportAt = millis();
+		Serial.print(F("ARDUINO: events="));
+		Serial.print(processEvents);
+		Serial.print(F(" us/event="));
+		Serial.print(processEvents ? processMicros / processEvents : 0);
+		for (uint8_t i = 0; i < 4; i++) {
+			Serial.print(F(" ch"));
+			Serial.print(i);
+			Serial.print('=');
+			Serial.print(channel[i].bytes);
+		}
+		Serial.println();
+		processMicros = 0;
+		processEvents = 0;
+	}
+}
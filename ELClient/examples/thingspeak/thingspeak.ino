@@ -103,6 +103,18 @@ char *api_key = "K9LDRXS7BXSN8X1J";
 // expand buffer size to your needs
 #define BUFLEN 266
 
+// Print the path of the update request straight into the request sent to esp-link, this is
+// called twice, first to measure the length of the path and then to send it
+boolean updatePath(Print* out, uint16_t chunk, void* ctx) {
+	ELClientRestPath path(out);
+	path.raw(F("/update"));
+	path.param(F("api_key"), api_key);
+	// If you have more than one field to update,
+	// repeat and change field1 to field2, field3, ...
+	path.param(F("field1"), solarValue, 2);
+	return false;
+}
+
 void loop() {
 	// process any callbacks coming from esp_link
 	esp.Process();
@@ -115,23 +127,9 @@ void loop() {
 		if (solarValue == 300) {
 			solarValue = 100;
 		}
-		String solarValString = String(solarValue);
-		const char *solarValChar = solarValString.c_str();
-		
-		// Reserve a buffer for sending the data
-		char path_data[BUFLEN];
-		// Copy the path and API key into the buffer
-		sprintf(path_data, "%s", "/update?api_key=");
-		sprintf(path_data + strlen(path_data), "%s", api_key);
-		
-		// Copy the field number and value into the buffer
-		// If you have more than one field to update,
-		// repeat and change field1 to field2, field3, ...
-		sprintf(path_data + strlen(path_data), "%s", "&field1=");
-		sprintf(path_data + strlen(path_data), "%s", solarValChar);
-		
-		// Send PUT request to thingspeak.com
-		rest.post(path_data,"");	
+
+		// Send POST request to thingspeak.com
+		rest.request(updatePath, NULL, "POST");
 
 		// Reserve a buffer for the response from Thingspeak
 		char response[BUFLEN];